@@ -22,10 +22,7 @@ VLA* VLA_initialize(size_t capacity, size_t item_size) {
 void VLA_expand(VLA* v, double factor) {
     // ceil() wird benutzt, damit man bei 1.x Faktoren über die 1er-capacity hinauskommt
     v->capacity = (size_t)ceil(v->capacity * factor);
-    v->memory->contents = realloc(v->memory->contents, v->capacity);
-    if (v->memory->contents == NULL) {
-        panic("%s\n", strerror(errno));
-    }
+    bytebuffer_grow(v->memory, v->capacity);
 }
 
 // Fügt ein Item ans Ende des VLA hinzu und vergrößert ihn vorher, wenn nötig.
@@ -50,22 +47,11 @@ void VLA_delete_by_index(VLA* v, size_t idx) {
     v->memory->length -= v->item_size;
 }
 
-// Gibt einen Pointer zu dem idx'ten pollfd struct im VLA zurück
-struct pollfd* VLA_get_pollfd(VLA* v, size_t idx) {
-    if (idx * v->item_size >= v->memory->length) {
-        warn("Index %ld is out of bounds for VLA with length=%ld. Can't get item, check your indices.\n", idx, v->memory->length / v->item_size);
-        return NULL;
-    }
-
-    return (struct pollfd*)(v->memory->contents + idx * v->item_size);
-}
-
-// Erstellt eine Pointer-Kopie des Bytebuffers und vertauscht die freeable-bits,
+// Erstellt eine Pointer-Kopie des Bytebuffers. Die Kopie hält eine eigene Referenz auf den Speicher,
 // sodass der VLA gelöscht werden kann, ohne dass man danach mit dem erstellten Bytebuffer einen use-after-free kriegt
 bytebuffer* VLA_into_bytebuffer(VLA* v) {
     bytebuffer* buffer = initialize_bytebuffer_with_values(NULL, 0);
     bytebuffer_shallow_copy(buffer, v->memory);
-    bytebuffer_transfer_ownership(buffer, v->memory);
     return buffer;
 }
 
@@ -0,0 +1,402 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "appendlog.h"
+#include "debug.h"
+
+// Liest den Log unter path und ruft für jeden vollständigen Record apply(record, context) auf. Key und Value vom Record
+// zeigen dabei direkt in die Datei und sind nur während apply() gültig.
+// Ein Record, der am Ende nur halb da ist, stammt von einem Absturz mitten im Schreiben. Er wird abgeschnitten,
+// damit neue Records nicht hinter dem kaputten Rest landen. Gibt die Anzahl der Records zurück, oder -1 bei Fehlern.
+// Gibt es die Datei noch nicht, ist das kein Fehler.
+int append_log_replay(const char* path, void (*apply)(crud_packet* record, void* context), void* context) {
+    int fd = open(path, O_RDWR);
+    if (fd == -1) {
+        if (errno == ENOENT) return 0;
+        warn("Couldn't open log %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        warn("%s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    uint8_t* contents = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (contents == MAP_FAILED) {
+        warn("%s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    madvise(contents, info.st_size, MADV_SEQUENTIAL);
+
+    crud_packet* record = get_blank_crud_packet();
+    size_t size = info.st_size;
+    size_t offset = 0;
+    int count = 0;
+    while (offset < size) {
+        if (size - offset < 1 + CRUD_HEADER_SIZE) break;
+
+        parse_crud_control(fd, record, contents + offset);
+        if (!crud_action_is_valid(record->action)) {
+            warn("Invalid record with action %#x at offset %zu.\n", record->action, offset);
+            break;
+        }
+        decode_crud_header(record, contents + offset + 1);
+        size_t extensions = crud_extension_size(record);
+        size_t length = 1 + CRUD_HEADER_SIZE + extensions + record->key->length + record->value->length;
+        if (size - offset < length) break;
+
+        decode_crud_extensions(record, contents + offset + 1 + CRUD_HEADER_SIZE);
+        record->key->contents = contents + offset + 1 + CRUD_HEADER_SIZE + extensions;
+        record->value->contents = record->key->contents + record->key->length;
+        apply(record, context);
+
+        offset += length;
+        count++;
+    }
+
+    if (offset < size) {
+        warn("Truncating log %s from %zu to %zu bytes, the rest is incomplete.\n", path, size, offset);
+        if (ftruncate(fd, offset) == -1) {
+            warn("%s\n", strerror(errno));
+        }
+    }
+
+    record->key->contents = NULL;
+    record->value->contents = NULL;
+    free_crud_packet(record);
+    munmap(contents, size);
+    close(fd);
+    return count;
+}
+
+static void write_all(int fd, const uint8_t* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            // Ab hier wären alle weiteren ACKs gelogen, dann lieber gar keine mehr
+            panic("Couldn't write to the log: %s\n", strerror(errno));
+        }
+        bytes += written;
+        length -= written;
+    }
+}
+
+static void sync_log(int fd) {
+    if (fdatasync(fd) == -1) {
+        panic("Couldn't sync the log: %s\n", strerror(errno));
+    }
+}
+
+// Vergrößert buffer, bis needed Bytes hineinpassen
+static void reserve(uint8_t** buffer, size_t* capacity, size_t needed) {
+    if (needed <= *capacity) return;
+
+    size_t grown_capacity = *capacity > 0 ? *capacity : APPEND_LOG_BUFFER_SIZE;
+    while (grown_capacity < needed) grown_capacity *= 2;
+    uint8_t* grown = realloc(*buffer, grown_capacity);
+    if (grown == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    *buffer = grown;
+    *capacity = grown_capacity;
+}
+
+// Damit ein rename() einen Absturz übersteht, muss auch das Verzeichnis gesynct werden.
+// Schreibt selbst nichts nach stderr, damit es auch nach einem fork() benutzt werden kann.
+int sync_parent_directory(const char* path) {
+    char* slash = strrchr(path, '/');
+    char directory[slash != NULL ? slash - path + 2 : 2];
+    if (slash != NULL) {
+        memcpy(directory, path, slash - path + 1);
+        directory[slash - path + 1] = '\0';
+    } else {
+        strcpy(directory, ".");
+    }
+
+    int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Steigt auf die umgeschriebene Datei switch_fd um. records sind die Records, die während dem Umschreiben dazukamen,
+// tail die aus dem aktuellen Schwung, die noch nicht darin stehen. Klappt das Umbenennen nicht, bleibt alles beim alten Log.
+static void switch_log(append_log* log, int switch_fd, uint8_t* records, size_t length, uint8_t* tail, size_t tail_length) {
+    write_all(switch_fd, records, length);
+    write_all(switch_fd, tail, tail_length);
+    sync_log(switch_fd);
+
+    if (rename(log->rewrite_path, log->path) == -1) {
+        warn("Couldn't replace %s with the rewritten log: %s\n", log->path, strerror(errno));
+        write_all(log->fd, tail, tail_length);
+        close(switch_fd);
+        unlink(log->rewrite_path);
+        pthread_mutex_lock(&log->lock);
+        log->file_size += tail_length;
+        pthread_mutex_unlock(&log->lock);
+        return;
+    }
+    if (sync_parent_directory(log->path) == -1) {
+        warn("Couldn't sync the directory of %s: %s\n", log->path, strerror(errno));
+    }
+
+    close(log->fd);
+    log->fd = switch_fd;
+    struct stat info;
+    uint64_t size = fstat(switch_fd, &info) == 0 ? (uint64_t)info.st_size : 0;
+
+    pthread_mutex_lock(&log->lock);
+    log->file_size = size;
+    log->base_size = size;
+    pthread_mutex_unlock(&log->lock);
+    debug("Switched to the rewritten log with %lu bytes.\n", (unsigned long)size);
+}
+
+static uint64_t monotonic_milliseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Schläft, bis neue Records da sind, oder bei LOG_FSYNC_INTERVAL bis zum nächsten fälligen fdatasync()
+static void wait_for_work(append_log* log, int unsynced, uint64_t next_sync) {
+    if (log->policy == LOG_FSYNC_INTERVAL && unsynced) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t now = monotonic_milliseconds();
+        uint64_t delay = next_sync > now ? next_sync - now : 0;
+        deadline.tv_sec += delay / 1000;
+        deadline.tv_nsec += (delay % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&log->wakeup, &log->lock, &deadline);
+    } else {
+        pthread_cond_wait(&log->wakeup, &log->lock);
+    }
+}
+
+static void* append_log_thread(void* argument) {
+    append_log* log = argument;
+    uint8_t* batch = NULL;
+    size_t batch_capacity = 0;
+    int unsynced = 0;
+    uint64_t next_sync = monotonic_milliseconds() + log->interval;
+
+    pthread_mutex_lock(&log->lock);
+    while (1) {
+        while (log->pending_length == 0 && !log->stopping && log->switch_fd == -1 &&
+               !(log->policy == LOG_FSYNC_INTERVAL && unsynced && monotonic_milliseconds() >= next_sync)) {
+            wait_for_work(log, unsynced, next_sync);
+        }
+        if (log->pending_length == 0 && log->stopping && log->switch_fd == -1) break;
+
+        // Puffer tauschen, damit die Event Loop sofort weiter anhängen kann
+        uint8_t* records = log->pending;
+        size_t capacity = log->pending_capacity;
+        size_t length = log->pending_length;
+        uint64_t target = log->appended;
+        log->pending = batch;
+        log->pending_capacity = batch_capacity;
+        log->pending_length = 0;
+        batch = records;
+        batch_capacity = capacity;
+
+        int switch_fd = log->switch_fd;
+        size_t switch_at = log->switch_at;
+        uint8_t* rewritten = NULL;
+        size_t rewritten_length = log->rewrite_length;
+        if (switch_fd != -1) {
+            rewritten = log->rewrite;
+            log->rewrite = NULL;
+            log->rewrite_length = 0;
+            log->rewrite_capacity = 0;
+            log->switch_fd = -1;
+        }
+        log->file_size += switch_fd != -1 ? switch_at : length;
+        pthread_mutex_unlock(&log->lock);
+
+        if (switch_fd != -1) {
+            // Die alte Datei bekommt nur noch, was auch in rewritten steht. Sie wird gleich ersetzt, falls das Umbenennen klappt.
+            write_all(log->fd, batch, switch_at);
+            switch_log(log, switch_fd, rewritten, rewritten_length, batch + switch_at, length - switch_at);
+            free(rewritten);
+        } else {
+            write_all(log->fd, batch, length);
+        }
+        if (length > 0) unsynced = 1;
+        if (log->policy == LOG_FSYNC_ALWAYS || (log->policy == LOG_FSYNC_INTERVAL && monotonic_milliseconds() >= next_sync)) {
+            if (unsynced) sync_log(log->fd);
+            unsynced = 0;
+            next_sync = monotonic_milliseconds() + log->interval;
+        }
+
+        pthread_mutex_lock(&log->lock);
+        log->durable = target;
+        if (log->policy == LOG_FSYNC_ALWAYS) {
+            uint64_t one = 1;
+            if (write(log->notify_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+                warn("%s\n", strerror(errno));
+            }
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    if (log->policy != LOG_FSYNC_NEVER && unsynced) sync_log(log->fd);
+    free(batch);
+    return NULL;
+}
+
+// Öffnet den Log zum Anhängen und startet den I/O Thread. interval wird nur bei LOG_FSYNC_INTERVAL gebraucht.
+int append_log_open(append_log* log, const char* path, log_fsync_policy policy, int interval) {
+    memset(log, 0, sizeof(append_log));
+    log->policy = policy;
+    log->interval = interval;
+    log->switch_fd = -1;
+
+    log->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (log->fd == -1) {
+        warn("Couldn't open log %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat info;
+    if (fstat(log->fd, &info) == 0) log->file_size = info.st_size;
+    log->base_size = log->file_size;
+
+    size_t path_length = strlen(path);
+    log->path = strdup(path);
+    log->rewrite_path = malloc(path_length + sizeof(".rewrite"));
+    if (log->path == NULL || log->rewrite_path == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    memcpy(log->rewrite_path, path, path_length);
+    memcpy(log->rewrite_path + path_length, ".rewrite", sizeof(".rewrite"));
+    log->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (log->notify_fd == -1) {
+        warn("%s\n", strerror(errno));
+        close(log->fd);
+        return -1;
+    }
+
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->wakeup, NULL);
+    int error = pthread_create(&log->thread, NULL, append_log_thread, log);
+    if (error != 0) {
+        panic("Couldn't start log thread: %s\n", strerror(error));
+    }
+
+    return 0;
+}
+
+// Hängt record an den Log an, ohne auf die Platte zu warten. Gibt das Ende vom Record im Log zurück. Sobald
+// append_log_durable() mindestens so groß ist, ist der Record so sicher gespeichert, wie die fsync Policy es verlangt.
+uint64_t append_log_write(append_log* log, crud_packet* record) {
+    size_t length = crud_encoded_size(record);
+
+    pthread_mutex_lock(&log->lock);
+    reserve(&log->pending, &log->pending_capacity, log->pending_length + length);
+    encode_crud_packet(record, log->pending + log->pending_length);
+    if (log->rewriting) {
+        reserve(&log->rewrite, &log->rewrite_capacity, log->rewrite_length + length);
+        memcpy(log->rewrite + log->rewrite_length, log->pending + log->pending_length, length);
+        log->rewrite_length += length;
+    }
+    // Der Thread muss nur geweckt werden, wenn er gerade auf neue Records wartet, sonst holt er sie nach dem Schreiben sowieso ab
+    if (log->pending_length == 0) pthread_cond_signal(&log->wakeup);
+    log->pending_length += length;
+    log->appended += length;
+    uint64_t position = log->appended;
+    pthread_mutex_unlock(&log->lock);
+
+    return position;
+}
+
+uint64_t append_log_durable(append_log* log) {
+    pthread_mutex_lock(&log->lock);
+    uint64_t durable = log->durable;
+    pthread_mutex_unlock(&log->lock);
+    return durable;
+}
+
+// Lohnt sich ein Umschreiben? Das ist der Fall, wenn der Log mindestens min_size groß ist und sich seit dem letzten
+// Umschreiben verdoppelt hat. So bleibt er höchstens etwa doppelt so groß wie die lebenden Daten, und das Umschreiben
+// kostet pro geschriebenem Byte im Schnitt nur konstant viel.
+int append_log_wants_rewrite(append_log* log, uint64_t min_size) {
+    pthread_mutex_lock(&log->lock);
+    int wants = !log->rewriting && log->switch_fd == -1 && log->file_size >= min_size && log->file_size >= 2 * log->base_size;
+    pthread_mutex_unlock(&log->lock);
+    return wants;
+}
+
+// Legt die Datei für den neuen Log an und fängt an, neue Records zusätzlich für sie zu sammeln.
+// Gibt den File Descriptor zurück, in den der neue Stand geschrieben werden soll, oder -1.
+int append_log_begin_rewrite(append_log* log) {
+    int fd = open(log->rewrite_path, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        warn("Couldn't create %s: %s\n", log->rewrite_path, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    log->rewriting = 1;
+    log->rewrite_length = 0;
+    pthread_mutex_unlock(&log->lock);
+    return fd;
+}
+
+// Der neue Stand steht komplett in fd. Der I/O Thread hängt die inzwischen gesammelten Records an und ersetzt den Log.
+void append_log_finish_rewrite(append_log* log, int fd) {
+    pthread_mutex_lock(&log->lock);
+    log->rewriting = 0;
+    log->switch_fd = fd;
+    log->switch_at = log->pending_length;
+    pthread_cond_signal(&log->wakeup);
+    pthread_mutex_unlock(&log->lock);
+}
+
+void append_log_abort_rewrite(append_log* log, int fd) {
+    pthread_mutex_lock(&log->lock);
+    log->rewriting = 0;
+    free(log->rewrite);
+    log->rewrite = NULL;
+    log->rewrite_length = 0;
+    log->rewrite_capacity = 0;
+    pthread_mutex_unlock(&log->lock);
+
+    close(fd);
+    unlink(log->rewrite_path);
+}
+
+// Schreibt alle noch ausstehenden Records weg, wartet auf den I/O Thread und schließt den Log.
+void append_log_close(append_log* log) {
+    pthread_mutex_lock(&log->lock);
+    log->stopping = 1;
+    pthread_cond_signal(&log->wakeup);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->thread, NULL);
+
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->wakeup);
+    free(log->pending);
+    free(log->rewrite);
+    free(log->path);
+    free(log->rewrite_path);
+    close(log->notify_fd);
+    close(log->fd);
+}
\ No newline at end of file
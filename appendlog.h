@@ -0,0 +1,66 @@
+#ifndef APPENDLOG_H
+#define APPENDLOG_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// Anfangsgröße vom Puffer, in dem die Event Loop Records für den I/O Thread sammelt
+#define APPEND_LOG_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    LOG_FSYNC_NEVER = 0,     // nur write(), den Rest macht das Betriebssystem irgendwann
+    LOG_FSYNC_INTERVAL = 1,  // spätestens alle interval Millisekunden ein fdatasync()
+    LOG_FSYNC_ALWAYS = 2,    // jede Antwort erst nach dem fdatasync(), in dem ihr Record steckt
+} log_fsync_policy;
+
+// Append-only Log aller SETs und DELs. Die Records sind einfach CRUD Pakete, so wie sie auch über den Socket gehen.
+//
+// Die Event Loop hängt Records nur an einen Puffer im Speicher an. Ein eigener I/O Thread nimmt sich jeweils alles,
+// was seit dem letzten Mal dazugekommen ist, und schreibt es mit einem write() und höchstens einem fdatasync() weg
+// (Group Commit). Während er auf die Platte wartet, sammelt sich der nächste Schwung im anderen Puffer an.
+// So kostet ein fdatasync() bei vielen gleichzeitigen Anfragen nicht mehr als bei einer einzigen.
+//
+// Beim Umschreiben baut jemand anders (der Datastore) aus dem aktuellen Stand eine neue Datei unter rewrite_path.
+// Records, die in der Zeit dazukommen, landen zusätzlich in rewrite. Ist die neue Datei fertig, hängt der I/O Thread
+// rewrite an, synct sie und benennt sie atomar in path um. Ab da schreibt er nur noch in die neue Datei.
+typedef struct {
+    int fd;  // gehört dem I/O Thread
+    char* path;
+    char* rewrite_path;
+    int notify_fd;  // eventfd, wird nach jedem Commit hochgezählt, damit die Event Loop wartende Antworten verschickt
+    log_fsync_policy policy;
+    int interval;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // Alles ab hier wird durch lock geschützt
+    uint8_t* pending;  // Records, die der I/O Thread noch nicht abgeholt hat
+    size_t pending_length;
+    size_t pending_capacity;
+    uint64_t appended;  // Ende vom letzten angehängten Record, gezählt ab dem Start vom Peer
+    uint64_t durable;   // bis hierhin ist alles so weit auf der Platte, wie policy es verlangt
+    uint64_t file_size;
+    uint64_t base_size;  // Größe beim Öffnen bzw. direkt nach dem letzten Umschreiben
+    uint8_t* rewrite;    // Records seit dem Start vom Umschreiben
+    size_t rewrite_length;
+    size_t rewrite_capacity;
+    int switch_fd;     // neue Datei, auf die der I/O Thread umsteigen soll, sonst -1
+    size_t switch_at;  // Records in pending vor dieser Stelle stehen schon in rewrite
+    unsigned int rewriting : 1;
+    unsigned int stopping : 1;
+} append_log;
+
+int sync_parent_directory(const char* path);
+int append_log_replay(const char* path, void (*apply)(crud_packet* record, void* context), void* context);
+int append_log_open(append_log* log, const char* path, log_fsync_policy policy, int interval);
+uint64_t append_log_write(append_log* log, crud_packet* record);
+uint64_t append_log_durable(append_log* log);
+int append_log_wants_rewrite(append_log* log, uint64_t min_size);
+int append_log_begin_rewrite(append_log* log);
+void append_log_finish_rewrite(append_log* log, int fd);
+void append_log_abort_rewrite(append_log* log, int fd);
+void append_log_close(append_log* log);
+
+#endif
\ No newline at end of file
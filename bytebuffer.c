@@ -5,28 +5,58 @@
 #include "bytebuffer.h"
 #include "debug.h"
 
+static void shared_block_release(shared_bytes* shared) {
+    free(shared);
+}
+
+// Neuer Block mit capacity Bytes und einer Referenz für den Aufrufer
+shared_block* shared_block_create(size_t capacity) {
+    shared_block* block = malloc(sizeof(shared_block) + capacity);
+    if (block == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    block->shared.references = 1;
+    block->shared.release = shared_block_release;
+    block->capacity = capacity;
+    return block;
+}
+
+shared_bytes* shared_bytes_retain(shared_bytes* shared) {
+    if (shared != NULL) __atomic_add_fetch(&shared->references, 1, __ATOMIC_RELAXED);
+    return shared;
+}
+
+// Das Freigeben muss alle Schreibzugriffe der anderen Threads sehen, die vorher ihre Referenz abgegeben haben
+void shared_bytes_release(shared_bytes* shared) {
+    if (shared != NULL && __atomic_sub_fetch(&shared->references, 1, __ATOMIC_ACQ_REL) == 0) shared->release(shared);
+}
+
+// Hält sonst niemand eine Referenz, darf der Besitzer den Speicher umbauen, ohne dass es jemand merkt
+int shared_bytes_is_exclusive(shared_bytes* shared) {
+    return __atomic_load_n(&shared->references, __ATOMIC_ACQUIRE) == 1;
+}
+
 bytebuffer* initialize_bytebuffer_with_capacity(size_t capacity) {
     bytebuffer* buffer = malloc(sizeof(bytebuffer));
     if (buffer == NULL) {
         panic("%s\n", strerror(errno));
     }
-    buffer->contents = malloc(capacity);
-    if (buffer->contents == NULL) {
-        panic("%s\n", strerror(errno));
-    }
-    buffer->contents_are_freeable = 1;
+    shared_block* block = shared_block_create(capacity);
+    buffer->contents = block->bytes;
+    buffer->owner = &block->shared;
     buffer->length = 0;
 
     return buffer;
 }
 
+// contents gehört danach nicht dem bytebuffer, für eigenen Speicher gibt es bytebuffer_allocate() und bytebuffer_share().
 bytebuffer* initialize_bytebuffer_with_values(uint8_t* contents, uint32_t length) {
     bytebuffer* buffer = malloc(sizeof(bytebuffer));
     if (buffer == NULL) {
         panic("%s\n", strerror(errno));
     }
     buffer->contents = contents;
-    buffer->contents_are_freeable = 0;  // wird hier nur gesetzt, damit es eine konsistente Vorgehensweise gibt. Für das richtige Setzen ist immer noch der Caller verantwortlich, da C nicht wissen kann, welche Adressen wirklich befreibar sind.
+    buffer->owner = NULL;
     buffer->length = length;
 
     return buffer;
@@ -35,26 +65,64 @@ bytebuffer* initialize_bytebuffer_with_values(uint8_t* contents, uint32_t length
 // Überträgt die Werte von from auf to, ohne die eigentlichen Bytes in bytebuffer->contents zu kopieren.
 // Das wird hier so gemacht, weil der Server potentiell viele große Datenmengen (~2^48 Bytes pro Anfrage) verwalten muss.
 // Deswegen: weniger Speicher und kopieren -> weniger Auslastung
+// to hält danach eine eigene Referenz auf den Speicher von from, beide können unabhängig voneinander freigegeben werden.
 void bytebuffer_shallow_copy(bytebuffer* to, bytebuffer* from) {
-    to->contents = from->contents;
-    to->contents_are_freeable = 0;
-    to->length = from->length;
+    bytebuffer_share(to, from->owner, from->contents, from->length);
 }
 
-// Diese Funktion vertauscht die freeable-bits von zwei Bytebuffern, solange diese auf den gleichen Speicher
-// zeigen und verschiedene Werte haben. Der Bytebuffer, für den das freeable-Bit auf 1 gesetzt ist, ist verantwortlich dafür,
-// dass dieser Bytebuffer am Ende vom Programm freigegeben wird. Wenn eine Menge an Bytebuffern also in contents auf die gleiche Adresse
-// zeigt, muss genau einer das freeable-Bit auf 1 gesetzt haben, alles andere ist ein Fehler, weil es sonst
-void bytebuffer_transfer_ownership(bytebuffer* buf1, bytebuffer* buf2) {
-    if (buf1->contents != buf2->contents) {
-        panic("Content addresses are not the same.\n");
+// to zeigt danach auf length Bytes ab offset in from, auch hier ohne zu kopieren
+void bytebuffer_slice(bytebuffer* to, bytebuffer* from, size_t offset, size_t length) {
+    if (offset + length > from->length) {
+        panic("Slice of %zu bytes at offset %zu is out of bounds for bytebuffer with length=%zu.\n", length, offset, from->length);
     }
+    bytebuffer_share(to, from->owner, from->contents + offset, length);
+}
 
-    if (buf1->contents_are_freeable == buf2->contents_are_freeable) return;
+// buffer zeigt danach auf contents in owner und hält dafür eine Referenz. Was buffer vorher gehalten hat, wird abgegeben.
+void bytebuffer_share(bytebuffer* buffer, shared_bytes* owner, uint8_t* contents, size_t length) {
+    shared_bytes_retain(owner);
+    shared_bytes_release(buffer->owner);
+    buffer->contents = contents;
+    buffer->owner = owner;
+    buffer->length = length;
+}
+
+// Gibt buffer length Bytes eigenen Speicher, der Inhalt ist danach undefiniert. Bei 0 Bytes wird nichts allokiert.
+void bytebuffer_allocate(bytebuffer* buffer, size_t length) {
+    shared_bytes_release(buffer->owner);
+    buffer->contents = NULL;
+    buffer->owner = NULL;
+    buffer->length = length;
+    if (length == 0) return;
+
+    shared_block* block = shared_block_create(length);
+    buffer->contents = block->bytes;
+    buffer->owner = &block->shared;
+}
 
-    int tmp = buf1->contents_are_freeable;
-    buf1->contents_are_freeable = buf2->contents_are_freeable;
-    buf2->contents_are_freeable = tmp;
+// Vergrößert den Speicher von buffer auf capacity Bytes, der Inhalt bleibt erhalten.
+// Geht nur, solange buffer sein shared_block von initialize_bytebuffer_with_capacity() allein gehört.
+void bytebuffer_grow(bytebuffer* buffer, size_t capacity) {
+    shared_block* block = (shared_block*)buffer->owner;
+    if (block == NULL || block->shared.release != shared_block_release || buffer->contents != block->bytes || !shared_bytes_is_exclusive(buffer->owner)) {
+        panic("Only bytebuffers with their own unshared block can grow.\n");
+    }
+
+    block = realloc(block, sizeof(shared_block) + capacity);
+    if (block == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    block->capacity = capacity;
+    buffer->contents = block->bytes;
+    buffer->owner = &block->shared;
+}
+
+// Gibt die Referenz von buffer ab, danach ist buffer leer
+void bytebuffer_reset(bytebuffer* buffer) {
+    shared_bytes_release(buffer->owner);
+    buffer->contents = NULL;
+    buffer->owner = NULL;
+    buffer->length = 0;
 }
 
 void print_bytebuffer(bytebuffer* buffer) {
@@ -64,6 +132,6 @@ void print_bytebuffer(bytebuffer* buffer) {
 }
 
 void free_bytebuffer(bytebuffer* buffer) {
-    if (buffer->contents_are_freeable) free(buffer->contents);
+    shared_bytes_release(buffer->owner);
     free(buffer);
 }
\ No newline at end of file
@@ -3,16 +3,42 @@
 
 #include <stdint.h>
 
+// Speicher mit Referenzzähler. Beliebig viele bytebuffer können auf Ausschnitte davon zeigen und halten dafür jeder
+// eine Referenz, wenn die letzte weg ist, gibt release() den Speicher frei. Der Zähler wird nur atomar geändert,
+// Referenzen dürfen also auch an andere Threads weitergegeben werden. release() selbst läuft in dem Thread,
+// der die letzte Referenz abgibt.
+typedef struct shared_bytes {
+    uint32_t references;
+    void (*release)(struct shared_bytes* shared);
+} shared_bytes;
+
+// Zähler und Bytes in einem Block von malloc(). So bekommen alle bytebuffer ihren eigenen Speicher, und auch der
+// Parser liest hier hinein: Keys und Values der Pakete zeigen dann direkt in den Block, statt kopiert zu werden.
+typedef struct {
+    shared_bytes shared;
+    size_t capacity;  // size_t statt uint32_t, damit bytes wie bei malloc() für jeden Typ ausgerichtet ist (VLA)
+    uint8_t bytes[];
+} shared_block;
+
 typedef struct {
     uint8_t* contents;
-    uint contents_are_freeable : 1;  // speichert, ob beim Löschen eines erstellten structs die Adresse in contents an free weitergegeben werden muss (zB. nicht bei Stack-Adressen, große reservierte Blöcke über mehrere bytebuffer, etc)
-    size_t length;                   // größter Wert, der hier potentiell gespeichert werden muss ist die Länge vom value, deswegen benutze ich hier nur uint32_t, und nicht so etwas wie __uint128_t.
+    shared_bytes* owner;  // Speicher, in dem contents liegt, der bytebuffer hält eine Referenz darauf. NULL, wenn contents jemand anderem gehört (zB. Stack-Adressen, Snapshot).
+    size_t length;        // größter Wert, der hier potentiell gespeichert werden muss ist die Länge vom value, deswegen benutze ich hier nur uint32_t, und nicht so etwas wie __uint128_t.
 } bytebuffer;
 
+shared_block* shared_block_create(size_t capacity);
+shared_bytes* shared_bytes_retain(shared_bytes* shared);
+void shared_bytes_release(shared_bytes* shared);
+int shared_bytes_is_exclusive(shared_bytes* shared);
+
 bytebuffer* initialize_bytebuffer_with_capacity(size_t capacity);
 bytebuffer* initialize_bytebuffer_with_values(uint8_t* contents, uint32_t length);
 void bytebuffer_shallow_copy(bytebuffer* to, bytebuffer* from);
-void bytebuffer_transfer_ownership(bytebuffer* buf1, bytebuffer* buf2);
+void bytebuffer_slice(bytebuffer* to, bytebuffer* from, size_t offset, size_t length);
+void bytebuffer_share(bytebuffer* buffer, shared_bytes* owner, uint8_t* contents, size_t length);
+void bytebuffer_allocate(bytebuffer* buffer, size_t length);
+void bytebuffer_grow(bytebuffer* buffer, size_t capacity);
+void bytebuffer_reset(bytebuffer* buffer);
 void print_bytebuffer(bytebuffer* buffer);
 void free_bytebuffer(bytebuffer* buffer);
 
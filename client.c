@@ -4,11 +4,16 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <errno.h>
-#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include "protocol.h"
+#include "parser.h"
 #include "VLA.h"
+#include "hash.h"
 #include "debug.h"
 
+#define PIPELINE_DEPTH 64
+
 // Liest Bytes vom File Descriptor fd, bis die Verbindung beendet wird oder es nichts mehr zu lesen gibt.
 bytebuffer *read_from_file(int fd) {
     VLA *stream = VLA_initialize(MAX_DATA_ACCEPT, sizeof(uint8_t));
@@ -48,12 +53,195 @@ bytebuffer *read_from_file(int fd) {
     return buffer;
 }
 
+// Baut aus einer Zeile "<Action> <Key> [<Value>]" ein CRUD Paket. Gibt NULL zurück, wenn die Zeile kaputt ist.
+// Die Bytebuffer zeigen in line hinein, line darf also erst nach dem Senden freigegeben werden.
+crud_packet *parse_batch_line(char *line) {
+    char *save = NULL;
+    char *action = strtok_r(line, " \t\n", &save);
+    char *key = strtok_r(NULL, " \t\n", &save);
+    if (action == NULL || key == NULL) return NULL;
+
+    char *ttl = NULL;
+    if (strcmp(action, "SETEX") == 0) {
+        ttl = strtok_r(NULL, " \t\n", &save);
+        if (ttl == NULL) return NULL;
+    }
+    char *value = strtok_r(NULL, "\n", &save);
+    crud_action a = 0;
+    if (strcmp(action, "GET") == 0) {
+        a = GET;
+    } else if (strcmp(action, "SET") == 0 || ttl != NULL) {
+        a = SET;
+    } else if (strcmp(action, "DELETE") == 0) {
+        a = DEL;
+    } else {
+        return NULL;
+    }
+
+    bytebuffer *key_buffer = initialize_bytebuffer_with_values((uint8_t *)key, strlen(key));
+    bytebuffer *value_buffer = initialize_bytebuffer_with_values(NULL, 0);
+    if (a == SET && value != NULL) {
+        value_buffer->contents = (uint8_t *)value;
+        value_buffer->length = strlen(value);
+    }
+
+    crud_packet *packet = initialize_crud_packet_with_values(a, key_buffer, value_buffer);
+    if (ttl != NULL) {
+        packet->reserved |= CRUD_FLAG_TTL;
+        packet->ttl = strtoul(ttl, NULL, 10);
+    }
+    return packet;
+}
+
+// Gibt eine Antwort im Batch-Modus als eine Zeile aus: bei GET das Value, sonst OK, und ohne ACK-Bit ERROR.
+void print_batch_response(crud_packet *response) {
+    if (!(response->action & ACK)) {
+        printf("ERROR\n");
+    } else if (response->action & GET) {
+        fwrite(response->value->contents, response->value->length, 1, stdout);
+        printf("\n");
+    } else {
+        printf("OK\n");
+    }
+}
+
+// Wartet auf die nächste Antwort. Der Parser liest dabei immer alles, was der Socket gerade hat, viele kleine
+// Antworten kosten also zusammen nur wenige recv() statt vier pro Antwort.
+crud_packet *receive_batch_response(packet_parser *parser, int connect_fd) {
+    while (1) {
+        generic_packet packet;
+        parser_status status = parser_receive(parser, connect_fd, &packet);
+        if (status == PARSER_COMPLETE) {
+            if (packet.type != PROTO_CRUD) {
+                panic("Server answered with a chord packet.\n");
+            }
+            return packet.contents;
+        }
+        if (status != PARSER_INCOMPLETE) {
+            panic("Connection to server was closed before all responses arrived.\n");
+        }
+
+        struct pollfd readable = {.fd = connect_fd, .events = POLLIN};
+        if (poll(&readable, 1, -1) == -1 && errno != EINTR) {
+            panic("%s\n", strerror(errno));
+        }
+    }
+}
+
+// Gibt alle Antworten aus, die schon komplett angekommen sind, ohne auf weitere zu warten
+void drain_batch_responses(packet_parser *parser, int connect_fd, size_t *in_flight) {
+    while (*in_flight > 0) {
+        generic_packet packet;
+        parser_status status = parser_receive(parser, connect_fd, &packet);
+        if (status == PARSER_INCOMPLETE) return;
+        if (status != PARSER_COMPLETE) {
+            panic("Connection to server was closed before all responses arrived.\n");
+        }
+        if (packet.type != PROTO_CRUD) {
+            panic("Server answered with a chord packet.\n");
+        }
+
+        print_batch_response(packet.contents);
+        free_crud_packet(packet.contents);
+        (*in_flight)--;
+    }
+}
+
+// Schickt packet, ohne den Socket zu blockieren. Ist der Socket voll, werden so lange die Antworten gelesen, die
+// schon ankommen. Der Peer liest keine Anfragen mehr, solange er selbst seine Antworten nicht loswird, ein großes SET
+// hinter vielen großen GET Antworten würde sonst beide Seiten blockieren.
+void send_batch_request(packet_parser *parser, int connect_fd, crud_packet *packet, size_t *in_flight) {
+    uint8_t prefix[CRUD_MAX_PREFIX_SIZE];
+    struct iovec iov[CRUD_IOVEC_COUNT];
+    struct iovec *remaining = iov;
+    int count = crud_packet_iovec(packet, prefix, iov);
+
+    while (count > 0) {
+        struct msghdr message = {.msg_iov = remaining, .msg_iovlen = count};
+        ssize_t bytes_sent = sendmsg(connect_fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (bytes_sent >= 0) {
+            count = iovec_advance(&remaining, count, bytes_sent);
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            panic("Failed to send packet to server: %s\n", strerror(errno));
+        }
+
+        struct pollfd ready = {.fd = connect_fd, .events = POLLOUT | (*in_flight > 0 ? POLLIN : 0)};
+        if (poll(&ready, 1, -1) == -1 && errno != EINTR) {
+            panic("%s\n", strerror(errno));
+        }
+        if (ready.revents & POLLIN) drain_batch_responses(parser, connect_fd, in_flight);
+    }
+}
+
+// Liest Zeilen der Form "GET <Key>", "DELETE <Key>", "SET <Key> <Value>" oder "SETEX <Key> <TTL> <Value>" von stdin und schickt sie alle
+// über eine einzige Verbindung. Es sind höchstens PIPELINE_DEPTH Anfragen gleichzeitig unterwegs. Dass sich Anfragen
+// und Antworten nicht gegenseitig in vollen Socket Buffern blockieren, egal wie groß sie sind, stellt send_batch_request() sicher.
+// Die Antworten kommen in der gleichen Reihenfolge zurück und werden zeilenweise ausgegeben.
+int run_batch(int connect_fd) {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    size_t in_flight = 0;
+    int line_number = 0;
+    packet_parser parser;
+    parser_initialize(&parser);
+
+    while (getline(&line, &line_capacity, stdin) != -1) {
+        line_number++;
+        crud_packet *packet = parse_batch_line(line);
+        if (packet == NULL) {
+            warn("Skipping malformed line %d.\n", line_number);
+            continue;
+        }
+
+        send_batch_request(&parser, connect_fd, packet, &in_flight);
+        free_crud_packet(packet);
+        in_flight++;
+
+        if (in_flight == PIPELINE_DEPTH) {
+            crud_packet *response = receive_batch_response(&parser, connect_fd);
+            print_batch_response(response);
+            free_crud_packet(response);
+            in_flight--;
+        }
+    }
+    free(line);
+    shutdown(connect_fd, SHUT_WR);
+
+    for (; in_flight > 0; in_flight--) {
+        crud_packet *response = receive_batch_response(&parser, connect_fd);
+        print_batch_response(response);
+        free_crud_packet(response);
+    }
+
+    parser_destruct(&parser);
+    close(connect_fd);
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 5) {
-        printf("Usage: %s <Host> <Port> <Action> <Key>\n", argv[0]);
+    if (argc == 4 && strcmp(argv[3], "BATCH") == 0) {
+        dbg_identifier = "Client";
+        int connect_fd = establish_tcp_connection(argv[1], argv[2]);
+        if (connect_fd < 0) {
+            exit(EXIT_FAILURE);
+        }
+        return run_batch(connect_fd);
+    }
+
+    if (argc != 5 && !(argc == 6 && strcmp(argv[3], "SET") == 0)) {
+        printf("Usage: %s <Host> <Port> <Action> <Key>\n       %s <Host> <Port> SET <Key> <TTL in Sekunden>\n       %s <Host> <Port> BATCH < commands\n", argv[0], argv[0], argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    // Zeigt nur an, auf welche Position im Ring der Key fällt, ohne etwas zu schicken. Die Peers rechnen mit der gleichen Funktion.
+    if (strcmp(argv[3], "HASH") == 0) {
+        printf("%u\n", hash_key_to_ring((uint8_t *)argv[4], strlen(argv[4])));
+        return EXIT_SUCCESS;
+    }
+
     dbg_identifier = "Client";
     char *host = argv[1];
     char *port = argv[2];
@@ -65,15 +253,13 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    bytebuffer *key_buffer = initialize_bytebuffer_with_values((uint8_t *)key, strlen(key));
-    key_buffer->contents_are_freeable = 0;  // key liegt auf dem Stack, free() geht also nicht
+    bytebuffer *key_buffer = initialize_bytebuffer_with_values((uint8_t *)key, strlen(key));  // key gehört argv, der bytebuffer gibt ihn also nicht frei
     bytebuffer *value_buffer;
 
     crud_action a = 0;
     if (strcmp(action, "GET") == 0) {
         a |= GET;
         value_buffer = initialize_bytebuffer_with_values(NULL, 0);
-        value_buffer->contents_are_freeable = 0;
     } else if (strcmp(action, "SET") == 0) {
         a |= SET;
         // Nur von stdin lesen, wenn man auch ein value zum Server senden muss.
@@ -83,7 +269,6 @@ int main(int argc, char **argv) {
     } else if (strcmp(action, "DELETE") == 0) {
         a |= DEL;
         value_buffer = initialize_bytebuffer_with_values(NULL, 0);
-        value_buffer->contents_are_freeable = 0;
     } else {
         panic("Illegal action %s.\n", action);
     }
@@ -93,6 +278,15 @@ int main(int argc, char **argv) {
     // In manchen Fällen kann es sonst passieren, dass der Server weiter versucht, von der Socket zu lesen,
     // obwohl nichts mehr gesendet wird.
     crud_packet *packet = initialize_crud_packet_with_values(a, key_buffer, value_buffer);
+    if (argc == 6) {
+        char *end;
+        unsigned long ttl = strtoul(argv[5], &end, 10);
+        if (*argv[5] == '\0' || *end != '\0' || ttl > UINT32_MAX) {
+            panic("Illegal TTL %s.\n", argv[5]);
+        }
+        packet->reserved |= CRUD_FLAG_TTL;
+        packet->ttl = ttl;
+    }
     if (send_crud_packet(connect_fd, packet) < 0) {
         panic("Failed to send packet to server.\n");
     }
@@ -1,97 +1,868 @@
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "datastore.h"
 #include "debug.h"
 
-// wird von uthash gebraucht, um Hash Table zu erstellen
-crud_packet *ds_hash_head = NULL;
+// Index über alle gespeicherten Keys. Früher war das eine uthash Tabelle aus crud_packets, da kamen auf jeden Eintrag
+// noch das UT_hash_handle und zwei bytebuffer dazu. Jetzt ist ein Eintrag ein 32 Byte Slot plus ein Block aus dem Slab.
+swiss_table ds_table;
+// Alle Blöcke mit langem Key und Value kommen von hier. Keys und Values, die vom Socket gelesen wurden,
+// werden einmal hineinkopiert, damit viele kleine Einträge nicht den Heap zerstückeln.
+slab_allocator ds_slab;
+// Alle Einträge mit TTL, sortiert nach Ablaufzeit
+timer_wheel ds_expiries;
+// Nur offen, wenn ds_settings.log_path gesetzt ist
+append_log ds_log;
+// Kindprozess, der gerade den Log aus dem aktuellen Stand neu schreibt, und die Datei, in die er schreibt
+pid_t ds_rewrite_pid = 0;
+int ds_rewrite_fd = -1;
+int ds_rewrite_requested = 0;
+// Snapshot vom letzten Beenden. Blöcke von Einträgen mit DS_ENTRY_MAPPED zeigen hier hinein.
+snapshot_mapping ds_snapshot = {.base = NULL, .length = 0};
+// Kindprozess, der gerade einen Snapshot schreibt. Der Fortschritt liegt in geteiltem Speicher, siehe ds_initialize().
+pid_t ds_snapshot_pid = 0;
+int ds_snapshot_requested = 0;
+uint32_t ds_snapshot_started = 0;  // Tick, zu dem der letzte Snapshot angefangen hat
+uint64_t ds_snapshot_started_ms = 0;
+size_t ds_snapshot_changes = 0;  // SETs und DELs seit dem Anfang vom letzten Snapshot
+snapshot_progress *ds_snapshot_progress = NULL;
+// Nur offen, wenn ds_settings.value_path gesetzt ist
+value_file ds_values;
+ds_config ds_settings;
+ds_counters ds_stats;
+// Bytes, die alle Einträge zusammen nach DS_ENTRY_COST belegen. Damit wird das Speicherlimit geprüft.
+size_t ds_used_bytes = 0;
+// Blöcke, auf die gerade Antworten zeigen, nach ihrer Adresse. DS_ENTRY_SHARED sagt, ob es sich lohnt, hier nachzusehen.
+ds_pin *ds_pins = NULL;
+ds_pin *ds_free_pins = NULL;
+// Ausgelagerte Values, die gerade mit sendfile() verschickt werden, nach ihrem Offset in der Value-Datei
+ds_value_pin *ds_value_pins = NULL;
+size_t ds_free_pin_count = 0;
+// Bitfeld für die Zulassung neuer Keys, siehe ds_doorkeeper_admits()
+uint64_t *ds_doorkeeper = NULL;
+size_t ds_doorkeeper_insertions = 0;
+
+// Monotone Uhr in Millisekunden, damit Änderungen an der Systemzeit keine Keys ablaufen lassen
+static uint64_t ds_monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000L;
+}
+
+// Aktuelle Zeit in Ticks von DS_EXPIRY_TICK Millisekunden
+static uint32_t ds_current_tick() {
+    return (uint32_t)(ds_monotonic_ms() / DS_EXPIRY_TICK);
+}
+
+// Speicher, den ein Eintrag mit so langem Key und Value belegt: Slot und Kontrollbyte im Index plus sein Block.
+// Leere Slots im Index und Verschnitt in den Slabs werden nicht mitgezählt, sonst würde jede Vergrößerung vom Index
+// auf einen Schlag einen Haufen Einträge verdrängen.
+static size_t ds_entry_cost(size_t key_length, size_t value_length, int expires) {
+    return sizeof(ds_entry) + 1 + (expires ? sizeof(ds_expiry) : 0) + (key_length > SWISS_INLINE_KEY_SIZE ? key_length : 0) + value_length;
+}
+
+static size_t ds_stored_cost(const ds_entry *entry) {
+    return sizeof(ds_entry) + 1 + ds_entry_block_size(entry);
+}
+
+// Wird aufgerufen, wenn die letzte Antwort auf den Block von pin verschickt ist
+static void ds_unpin(shared_bytes *shared) {
+    ds_pin *pin = (ds_pin *)shared;
+    if (!pin->orphaned) {
+        HASH_DEL(ds_pins, pin);
+    } else if (!pin->mapped) {
+        slab_free(&ds_slab, pin->block, pin->size);
+    }
+
+    if (ds_free_pin_count >= DS_PIN_CACHE_SIZE) {
+        free(pin);
+        return;
+    }
+    pin->next_free = ds_free_pins;
+    ds_free_pins = pin;
+    ds_free_pin_count++;
+}
+
+// Gibt eine neue Referenz auf den Block von entry zurück. Solange es eine gibt, bleibt der Block liegen.
+static shared_bytes *ds_pin_block(ds_entry *entry) {
+    ds_pin *pin = NULL;
+    if (entry->flags & DS_ENTRY_SHARED) HASH_FIND_PTR(ds_pins, &entry->block, pin);
+    if (pin != NULL) return shared_bytes_retain(&pin->shared);
+
+    pin = ds_free_pins;
+    if (pin != NULL) {
+        ds_free_pins = pin->next_free;
+        ds_free_pin_count--;
+    } else {
+        pin = malloc(sizeof(ds_pin));
+        if (pin == NULL) {
+            panic("%s\n", strerror(errno));
+        }
+    }
+    pin->shared.references = 1;
+    pin->shared.release = ds_unpin;
+    pin->block = entry->block;
+    pin->size = ds_entry_block_size(entry);
+    pin->mapped = (entry->flags & DS_ENTRY_MAPPED) != 0;
+    pin->orphaned = 0;
+    HASH_ADD_PTR(ds_pins, block, pin);
+    entry->flags |= DS_ENTRY_SHARED;
+    return &pin->shared;
+}
+
+// Wird aufgerufen, wenn die letzte Antwort, die das Value von pin mit sendfile() verschickt, fertig ist
+static void ds_unpin_value(shared_bytes *shared) {
+    ds_value_pin *pin = (ds_value_pin *)shared;
+    if (!pin->orphaned) {
+        HASH_DEL(ds_value_pins, pin);
+    } else {
+        value_file_release(&ds_values, pin->offset, pin->length);
+    }
+    free(pin);
+}
+
+// Gibt eine neue Referenz auf das ausgelagerte Value von entry zurück. Solange es eine gibt, wird sein Bereich
+// in der Value-Datei nicht gelocht, auch wenn der Eintrag vorher gelöscht oder ersetzt wird.
+static shared_bytes *ds_pin_value(ds_entry *entry) {
+    uint64_t offset = ds_entry_spilled_offset(entry);
+    ds_value_pin *pin = NULL;
+    if (entry->flags & DS_ENTRY_SHARED) HASH_FIND(hh, ds_value_pins, &offset, sizeof(offset), pin);
+    if (pin != NULL) return shared_bytes_retain(&pin->shared);
+
+    pin = malloc(sizeof(ds_value_pin));
+    if (pin == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    pin->shared.references = 1;
+    pin->shared.release = ds_unpin_value;
+    pin->offset = offset;
+    pin->length = entry->value_length;
+    pin->orphaned = 0;
+    HASH_ADD(hh, ds_value_pins, offset, sizeof(pin->offset), pin);
+    entry->flags |= DS_ENTRY_SHARED;
+    return &pin->shared;
+}
+
+// Gibt das ausgelagerte Value von entry in der Value-Datei frei. Verschickt es gerade eine Antwort, passiert das
+// erst in ds_unpin_value().
+static void ds_release_value(const ds_entry *entry) {
+    uint64_t offset = ds_entry_spilled_offset(entry);
+    ds_value_pin *pin = NULL;
+    if (entry->flags & DS_ENTRY_SHARED) HASH_FIND(hh, ds_value_pins, &offset, sizeof(offset), pin);
+    if (pin != NULL) {
+        HASH_DEL(ds_value_pins, pin);
+        pin->orphaned = 1;
+        return;
+    }
+    value_file_release(&ds_values, offset, entry->value_length);
+}
+
+// Gibt den Block von entry an seinen Slab zurück. Zeigt noch eine Antwort hinein, passiert das erst in ds_unpin().
+static void ds_release_block(const ds_entry *entry) {
+    ds_pin *pin = NULL;
+    if (entry->flags & DS_ENTRY_SHARED) HASH_FIND_PTR(ds_pins, &entry->block, pin);
+    if (pin != NULL) {
+        HASH_DEL(ds_pins, pin);
+        pin->orphaned = 1;
+        return;
+    }
+    if (!(entry->flags & DS_ENTRY_MAPPED)) slab_free(&ds_slab, entry->block, ds_entry_block_size(entry));
+}
+
+// Gibt den Block von entry an seinen Slab zurück und nimmt vorher seine Ablaufzeit aus dem Timer-Rad.
+// Ein ausgelagertes Value wird in der Value-Datei freigegeben.
+static void ds_free_block(const ds_entry *entry) {
+    ds_expiry *expiry = ds_entry_expiry(entry);
+    if (expiry != NULL) timer_wheel_remove(&ds_expiries, &expiry->timer);
+    if (entry->flags & DS_ENTRY_SPILLED) ds_release_value(entry);
+    ds_release_block(entry);
+}
+
+static void ds_remove_entry(ds_entry *entry) {
+    ds_used_bytes -= ds_stored_cost(entry);
+    ds_free_block(entry);
+    swiss_erase(&ds_table, entry);
+}
+
+static int ds_entry_is_expired(const ds_entry *entry) {
+    ds_expiry *expiry = ds_entry_expiry(entry);
+    return expiry != NULL && (int32_t)(ds_current_tick() - expiry->timer.deadline) >= 0;
+}
+
+// Wird vom Timer-Rad für jeden abgelaufenen Eintrag aufgerufen
+static void ds_expire(wheel_timer *timer, void *context) {
+    ds_expiry *expiry = (ds_expiry *)timer;
+    ds_entry *entry = swiss_find_block(&ds_table, expiry->hash, (uint8_t *)expiry);
+    if (entry == NULL) {
+        warn("Expired timer doesn't belong to any entry.\n");
+        return;
+    }
+
+    debug("Entry with %u byte key expired.\n", entry->key_length);
+    ds_stats.expirations++;
+    ds_remove_entry(entry);
+}
+
+// Zählt einen Eintrag aus dem Snapshot mit und hängt seine Ablaufzeit, die dort als Unixzeit steht, ins Timer-Rad.
+// Ist sie schon vorbei, läuft er beim nächsten Tick ab.
+static void ds_adopt_snapshot_entry(ds_entry *entry, void *context) {
+    time_t now = *(time_t *)context;
+    ds_used_bytes += ds_stored_cost(entry);
+
+    ds_expiry *expiry = ds_entry_expiry(entry);
+    if (expiry == NULL) return;
+    int64_t remaining = (int64_t)expiry->timer.deadline - now;
+    expiry->timer.pprev = NULL;
+    timer_wheel_add(&ds_expiries, &expiry->timer, ds_current_tick() + (remaining > 0 ? remaining * DS_TICKS_PER_SECOND : 0));
+}
+
+// Wendet einen Record aus dem Log an. Im Log steht bei TTLs der Zeitpunkt (Unixzeit), an dem der Eintrag abläuft,
+// weil die Zeit bis zum Neustart sonst nicht mitzählen würde. Ist der schon vorbei, wäre der Eintrag inzwischen weg.
+static void ds_replay_record(crud_packet *record, void *context) {
+    if (record->action == DEL) {
+        ds_delete(record->key);
+        return;
+    }
+
+    if (record->reserved & CRUD_FLAG_TTL) {
+        time_t now = time(NULL);
+        if ((time_t)record->ttl <= now) {
+            ds_delete(record->key);
+            return;
+        }
+        record->ttl -= now;
+    }
+    ds_set(record);
+}
+
+// Hängt eine ausgeführte Änderung an den Log an und gibt ihr Ende im Log zurück
+static uint64_t ds_log_change(crud_packet *pkg) {
+    bytebuffer no_value = {.contents = NULL, .owner = NULL, .length = 0};
+    crud_packet record = {
+        .reserved = 0,
+        .action = pkg->action,
+        .key = pkg->key,
+        .value = pkg->action == SET ? pkg->value : &no_value,
+    };
+    if (pkg->action == SET && (pkg->reserved & CRUD_FLAG_TTL) && pkg->ttl > 0) {
+        record.reserved = CRUD_FLAG_TTL;
+        record.ttl = time(NULL) + (pkg->ttl > DS_MAX_TTL ? DS_MAX_TTL : pkg->ttl);
+    }
+    return append_log_write(&ds_log, &record);
+}
+
+void ds_initialize(ds_config *config) {
+    ds_settings = *config;
+    memset(&ds_stats, 0, sizeof(ds_stats));
+    swiss_initialize(&ds_table);
+    slab_initialize(&ds_slab);
+    timer_wheel_initialize(&ds_expiries, ds_current_tick());
+
+    if (ds_settings.admission) {
+        ds_doorkeeper = calloc(DS_DOORKEEPER_BITS / 64, sizeof(uint64_t));
+        if (ds_doorkeeper == NULL) {
+            panic("%s\n", strerror(errno));
+        }
+    }
+
+    // Vor Snapshot und Log, beim Abspielen werden große Values schon ausgelagert
+    if (ds_settings.value_path != NULL && value_file_open(&ds_values, ds_settings.value_path) == -1) {
+        panic("Couldn't open value file %s.\n", ds_settings.value_path);
+    }
+
+    // Der Snapshot wird nur gemappt, die Values kommen erst bei Bedarf von der Platte. Ein Log danach enthält alles,
+    // was seit dem Snapshot passiert ist, und wird darüber abgespielt.
+    if (ds_settings.snapshot_path != NULL && snapshot_map(ds_settings.snapshot_path, &ds_snapshot) == 0 && snapshot_restore(&ds_snapshot, &ds_table) == 0) {
+        time_t now = time(NULL);
+        swiss_foreach(&ds_table, ds_adopt_snapshot_entry, &now);
+        debug("Mapped snapshot %s with %zu entries.\n", ds_settings.snapshot_path, ds_table.size);
+    }
+    if (ds_settings.snapshot_path != NULL) {
+        ds_snapshot_progress = mmap(NULL, sizeof(snapshot_progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (ds_snapshot_progress == MAP_FAILED) {
+            panic("%s\n", strerror(errno));
+        }
+        memset(ds_snapshot_progress, 0, sizeof(snapshot_progress));
+        ds_snapshot_started = ds_current_tick();
+    }
+
+    // Erst den alten Log abspielen, dann zum Anhängen öffnen, sonst würde jeder Record gleich noch einmal geschrieben
+    if (ds_settings.log_path != NULL) {
+        int replayed = append_log_replay(ds_settings.log_path, ds_replay_record, NULL);
+        if (replayed == -1) {
+            panic("Couldn't replay log %s.\n", ds_settings.log_path);
+        }
+        debug("Replayed %d records from %s, %zu entries in the datastore.\n", replayed, ds_settings.log_path, ds_table.size);
+        if (append_log_open(&ds_log, ds_settings.log_path, ds_settings.fsync_policy, ds_settings.fsync_interval) == -1) {
+            panic("Couldn't open log %s.\n", ds_settings.log_path);
+        }
+    }
+}
+
+// Merkt sich, dass hash gerade geschrieben werden sollte, und sagt, ob das vorher schon einmal passiert ist.
+// Das Bitfeld ist ein kleiner Bloom-Filter mit zwei Bits pro Key, der regelmäßig geleert wird, damit er nicht vollläuft.
+// So werden bei vollem Speicher nur Keys aufgenommen, die mehr als einmal geschrieben werden, und ein einmaliger
+// Durchlauf über viele neue Keys kann die häufig benutzten Einträge nicht verdrängen.
+static int ds_doorkeeper_admits(uint32_t hash) {
+    uint32_t first = hash & (DS_DOORKEEPER_BITS - 1);
+    uint32_t second = (hash * 0x9E3779B1u) >> (32 - DS_DOORKEEPER_SHIFT);
+    int seen = (ds_doorkeeper[first / 64] >> (first % 64)) & (ds_doorkeeper[second / 64] >> (second % 64)) & 1;
+
+    ds_doorkeeper[first / 64] |= 1ull << (first % 64);
+    ds_doorkeeper[second / 64] |= 1ull << (second % 64);
+    if (++ds_doorkeeper_insertions >= DS_DOORKEEPER_BITS / 8) {
+        memset(ds_doorkeeper, 0, DS_DOORKEEPER_BITS / 8);
+        ds_doorkeeper_insertions = 0;
+    }
+
+    return seen;
+}
+
+// Lagert das Value von entry in die Value-Datei aus. Der Block wird durch einen kleineren mit dem Offset ersetzt,
+// dabei muss auch die Ablaufzeit ins neue Timer-Rad-Element umziehen. Gibt -1 zurück, wenn nicht geschrieben werden konnte.
+static int ds_spill(ds_entry *entry) {
+    int64_t offset = value_file_append(&ds_values, ds_entry_value(entry), entry->value_length);
+    if (offset == -1) return -1;
+
+    ds_entry old = *entry;
+    size_t prefix = ds_entry_block_size(&old) - old.value_length;  // Ablaufzeit und langer Key bleiben, wie sie sind
+    entry->flags = (entry->flags | DS_ENTRY_SPILLED) & ~(DS_ENTRY_MAPPED | DS_ENTRY_SHARED);
+    entry->block = slab_alloc(&ds_slab, ds_entry_block_size(entry));
+    memcpy(entry->block, old.block, prefix);
+    ds_entry_set_spilled_offset(entry, offset);
+
+    ds_expiry *expiry = ds_entry_expiry(&old);
+    if (expiry != NULL) {
+        timer_wheel_remove(&ds_expiries, &expiry->timer);
+        ds_expiry *moved = ds_entry_expiry(entry);
+        moved->timer.pprev = NULL;
+        timer_wheel_add(&ds_expiries, &moved->timer, expiry->timer.deadline);
+    }
+    ds_release_block(&old);
+
+    ds_used_bytes -= ds_stored_cost(&old) - ds_stored_cost(entry);
+    ds_stats.spills++;
+    ds_stats.spilled_bytes += old.value_length;
+    return 0;
+}
+
+// Verdrängt einen Eintrag nach dem CLOCK-Verfahren. Gibt -1 zurück, wenn es nichts mehr zu verdrängen gibt.
+// Mit Value-Datei wird ein großes Value erst einmal nur ausgelagert. Ausgelagerte Einträge kosten danach kaum noch
+// etwas, bei ihnen sucht der CLOCK-Zeiger weiter. Erst wenn er DS_SPILL_SEARCH_LIMIT davon in Folge findet, also
+// kaum noch Values im Speicher sind, fliegt einer ganz raus.
+static int ds_evict_one() {
+    ds_entry *victim = swiss_clock_victim(&ds_table);
+    for (int skipped = 0; victim != NULL && ds_settings.value_path != NULL && skipped < DS_SPILL_SEARCH_LIMIT; skipped++) {
+        if (!(victim->flags & DS_ENTRY_SPILLED)) {
+            if (victim->value_length < DS_COLD_SPILL_MIN_SIZE) break;
+            debug("Spilling %u byte value of a cold entry to the value file.\n", victim->value_length);
+            if (ds_spill(victim) == -1) break;
+            victim->flags |= DS_ENTRY_REFERENCED;  // sonst bliebe der Zeiger in previous gleich wieder bei ihm stehen
+            return 0;
+        }
+        victim->flags |= DS_ENTRY_REFERENCED;
+        victim = swiss_clock_victim(&ds_table);
+    }
+    if (victim == NULL) return -1;
+
+    size_t cost = ds_stored_cost(victim);
+    debug("Evicting entry with %u byte key and %u byte value.\n", victim->key_length, victim->value_length);
+    ds_remove_entry(victim);
+
+    ds_stats.evictions++;
+    ds_stats.evicted_bytes += cost;
+    return 0;
+}
 
 // Führt die Request vom Client aus und gibt eine Antwort zurück, die dann zum Client zurückgesendet werden kann.
+// Mit Log und LOG_FSYNC_ALWAYS steht danach in *log_position, bis wohin der Log gesynct sein muss, bevor die Antwort
+// raus darf, sonst 0.
 // Die Antwort enthält:
 //  - Aktionsbit der Request sowie ACK-Bit, falls Request ausgeführt werden konnte
-//  - bei GET: gesetztes Value
+//  - bei GET: gesetztes Value, abgelaufene Einträge zählen wie fehlende als Miss
 //  - bei SET: nichts zusätzliches
 //  - bei DEL: nichts zusätzliches
-crud_packet *execute_ds_action(crud_packet *pkg) {
+crud_packet *execute_ds_action(crud_packet *pkg, uint64_t *log_position) {
     crud_packet *response = get_blank_crud_packet();
     response->action = pkg->action;
+    uint64_t logged = 0;
+    *log_position = 0;
 
     switch (pkg->action) {
         case GET:
             bytebuffer_shallow_copy(response->key, pkg->key);
-            crud_packet *entry = ds_query(pkg->key);
-            if (entry != NULL) {
+            ds_entry *entry = ds_query(pkg->key);
+            if (entry != NULL && (entry->flags & DS_ENTRY_SPILLED) && entry->value_length >= DS_SENDFILE_MIN_SIZE) {
+                // Große ausgelagerte Values verschickt der Peer mit sendfile(), sie kommen gar nicht erst in den Speicher
+                ds_stats.hits++;
+                ds_stats.disk_reads++;
+                entry->flags |= DS_ENTRY_REFERENCED;
+                response->action |= ACK;
+                response->value->length = entry->value_length;
+                response->value->owner = ds_pin_value(entry);
+                response->value_in_file = 1;
+                response->value_fd = ds_values.fd;
+                response->value_offset = ds_entry_spilled_offset(entry);
+            } else if (entry != NULL && (entry->flags & DS_ENTRY_SPILLED)) {
+                // Kleinere ausgelagerte Values werden für jede Antwort frisch aus der Datei gelesen
+                bytebuffer_allocate(response->value, entry->value_length);
+                if (value_file_read(&ds_values, ds_entry_spilled_offset(entry), response->value->contents, entry->value_length) == -1) {
+                    warn("Couldn't read %u byte value from the value file: %s\n", entry->value_length, strerror(errno));
+                    bytebuffer_reset(response->value);
+                    ds_stats.misses++;
+                    return response;
+                }
+                ds_stats.hits++;
+                ds_stats.disk_reads++;
+                entry->flags |= DS_ENTRY_REFERENCED;
+                response->action |= ACK;
+            } else if (entry != NULL) {
+                ds_stats.hits++;
+                entry->flags |= DS_ENTRY_REFERENCED;
                 response->action |= ACK;
-                bytebuffer_shallow_copy(response->value, entry->value);
+                // Die Antwort zeigt direkt auf das Value im Block und hält ihn fest, siehe ds_pin
+                response->value->contents = ds_entry_value(entry);
+                response->value->length = entry->value_length;
+                response->value->owner = entry->value_length > 0 ? ds_pin_block(entry) : NULL;
+            } else {
+                ds_stats.misses++;
             }
             return response;
-        case SET:
-            ds_set(pkg);
-            response->action |= ACK;
-            return response;
+        case SET: {
+            int stored = ds_set(pkg);
+            if (stored >= 0) response->action |= ACK;
+            if (stored == 0) ds_snapshot_changes++;
+            if (stored == 0 && ds_settings.log_path != NULL) logged = ds_log_change(pkg);
+            break;
+        }
         case DEL:
-            if (ds_delete(pkg->key) >= 0) response->action |= ACK;
-            return response;
+            if (ds_delete(pkg->key) >= 0) {
+                response->action |= ACK;
+                ds_snapshot_changes++;
+                if (ds_settings.log_path != NULL) logged = ds_log_change(pkg);
+            }
+            break;
         default:
             warn("Illegal request parameter %#x. Something is getting through struct un/packing functions!\n", pkg->action);
             return NULL;
     }
-}
 
-// überprüft, ob der Key schon im Hash Table existiert und gibt
-// das zugehörige struct zurück, falls ja.
-// Wenn es das struct nicht gibt, wird NULL zurückgegeben.
-crud_packet *ds_query(bytebuffer *key) {
-    crud_packet *output = NULL;
-    HASH_FIND(hh, ds_hash_head, key->contents, key->length, output);
+    if (ds_settings.fsync_policy == LOG_FSYNC_ALWAYS) *log_position = logged;
+    return response;
+}
 
-    return output;
+// überprüft, ob der Key schon im Datastore existiert und gibt
+// den zugehörigen Eintrag zurück, falls ja.
+// Wenn es den Eintrag nicht gibt, wird NULL zurückgegeben.
+// Der Pointer ist nur bis zur nächsten Änderung am Datastore gültig, das Value selbst bleibt bis zum nächsten SET oder DEL vom Key liegen.
+// Ist der Eintrag schon abgelaufen, das Timer-Rad aber noch nicht so weit, wird er hier gelöscht und NULL zurückgegeben.
+ds_entry *ds_query(bytebuffer *key) {
+    ds_entry *entry = swiss_find(&ds_table, key->contents, key->length, swiss_hash(key->contents, key->length));
+    if (entry != NULL && ds_entry_is_expired(entry)) {
+        debug("Entry for key %.*s has expired.\n", key->length, (char *)key->contents);
+        ds_stats.expirations++;
+        ds_remove_entry(entry);
+        return NULL;
+    }
+    return entry;
 }
 
-// Fügt ein neues struct zum Hash Table hinzu, oder modifiziert den Wert eines structs
-// mit dem gleichen Key, falls es so eins gibt.
-void ds_set(crud_packet *pkg) {
-    crud_packet *entry = ds_query(pkg->key);
+// Fügt einen neuen Eintrag zum Datastore hinzu, oder ersetzt das Value vom Eintrag
+// mit dem gleichen Key, falls es so einen gibt. Key und Value landen zusammen in einem neuen Block,
+// der alte Block geht danach an seinen Slab zurück. Mit TTL fängt der Block mit der Ablaufzeit an, die gleich ins
+// Timer-Rad kommt. Ein SET ohne TTL macht aus einem ablaufenden Eintrag wieder einen, der für immer bleibt.
+// Values ab ds_settings.spill_threshold gehen gleich in die Value-Datei, im Block steht dann nur ihr Offset.
+// Mit Speicherlimit werden vorher so lange Einträge verdrängt, bis der neue Platz hat. Gibt -1 zurück, wenn das Value
+// allein schon größer als das Limit ist. Lässt die Zulassung einen neuen Key nicht herein, wird 1 zurückgegeben. Das wird
+// trotzdem bestätigt, weil der Peer dann wie ein Cache arbeitet, der Einträge jederzeit verlieren darf.
+int ds_set(crud_packet *pkg) {
+    uint32_t hash = swiss_hash(pkg->key->contents, pkg->key->length);
+    int expires = (pkg->reserved & CRUD_FLAG_TTL) && pkg->ttl > 0;
+    int spill = ds_settings.value_path != NULL && pkg->value->length > 0 && pkg->value->length >= ds_settings.spill_threshold;
+    size_t cost = ds_entry_cost(pkg->key->length, spill ? sizeof(uint64_t) : pkg->value->length, expires);
 
-    if (!entry) {
-        debug("No entry found for key %s, creating new one.\n", (char *)pkg->key->contents);
-        crud_packet *new = get_blank_crud_packet();
-        bytebuffer_shallow_copy(new->key, pkg->key);
-        bytebuffer_transfer_ownership(new->key, pkg->key);
-        bytebuffer_shallow_copy(new->value, pkg->value);
-        bytebuffer_transfer_ownership(new->value, pkg->value);
-        HASH_ADD_KEYPTR(hh, ds_hash_head, new->key->contents, new->key->length, new);
+    if (ds_settings.memory_limit > 0) {
+        if (cost > ds_settings.memory_limit) {
+            warn("Entry with %u byte value doesn't fit into the memory limit of %zu bytes.\n", pkg->value->length, ds_settings.memory_limit);
+            return -1;
+        }
+
+        ds_entry *existing = swiss_find(&ds_table, pkg->key->contents, pkg->key->length, hash);
+        size_t old_cost = 0;
+        if (existing != NULL) {
+            old_cost = ds_stored_cost(existing);
+            existing->flags |= DS_ENTRY_REFERENCED;
+        }
+
+        int admitted = existing != NULL || !ds_settings.admission || ds_doorkeeper_admits(hash);
+        if (ds_used_bytes + cost > ds_settings.memory_limit + old_cost && !admitted) {
+            debug("Not admitting key %.*s, it wasn't written recently.\n", pkg->key->length, (char *)pkg->key->contents);
+            ds_stats.admission_rejects++;
+            return 1;
+        }
+
+        // existing ist ab hier nicht mehr gültig, beim Verdrängen können Einträge umziehen oder existing selbst
+        // verdrängt bzw. ausgelagert werden. old_cost ist dann zu groß und wird deswegen nie von ds_used_bytes abgezogen.
+        while (ds_used_bytes + cost > ds_settings.memory_limit + old_cost && ds_evict_one() == 0) {
+        }
+    }
+
+    int inserted = 0;
+    ds_entry *entry = swiss_insert(&ds_table, pkg->key->contents, pkg->key->length, hash, &inserted);
+    ds_entry old = *entry;
+
+    if (inserted) {
+        ds_used_bytes += cost;
+    } else {
+        ds_used_bytes += cost - ds_stored_cost(entry);
+        entry->flags |= DS_ENTRY_REFERENCED;
+    }
+
+    if (inserted) {
+        debug("No entry found for key %.*s, creating new one.\n", pkg->key->length, (char *)pkg->key->contents);
     } else {
-        debug("Found entry for key %s, now replacing old value %s with new value %s.\n", (char *)pkg->key->contents, (char *)entry->value->contents, (char *)pkg->value->contents);
-        if (entry->value->contents_are_freeable) free(entry->value->contents);
-        bytebuffer_shallow_copy(entry->value, pkg->value);
-        bytebuffer_transfer_ownership(entry->value, pkg->value);
+        debug("Found entry for key %.*s, now replacing old value.\n", pkg->key->length, (char *)pkg->key->contents);
+    }
+
+    // Klappt das Schreiben in die Value-Datei nicht, bleibt das Value eben im Speicher
+    int64_t offset = spill ? value_file_append(&ds_values, pkg->value->contents, pkg->value->length) : -1;
+    if (spill && offset == -1) ds_used_bytes += pkg->value->length - sizeof(uint64_t);
+
+    entry->value_length = pkg->value->length;
+    entry->flags = (expires ? entry->flags | DS_ENTRY_EXPIRES : entry->flags & ~DS_ENTRY_EXPIRES) & ~(DS_ENTRY_MAPPED | DS_ENTRY_SPILLED | DS_ENTRY_SHARED);
+    if (offset != -1) entry->flags |= DS_ENTRY_SPILLED;
+    entry->block = slab_alloc(&ds_slab, ds_entry_block_size(entry));
+    if (entry->key_length > SWISS_INLINE_KEY_SIZE) memcpy((uint8_t *)ds_entry_key(entry), pkg->key->contents, entry->key_length);
+    if (offset != -1) {
+        ds_entry_set_spilled_offset(entry, offset);
+    } else if (entry->value_length > 0) {
+        memcpy(ds_entry_value(entry), pkg->value->contents, entry->value_length);
+    }
+
+    if (expires) {
+        ds_expiry *expiry = ds_entry_expiry(entry);
+        uint32_t ttl = pkg->ttl > DS_MAX_TTL ? DS_MAX_TTL : pkg->ttl;
+        expiry->hash = hash;
+        expiry->timer.pprev = NULL;
+        // Ein Tick mehr, damit der Eintrag nie vor Ablauf der TTL verschwindet, auch wenn der aktuelle Tick schon fast vorbei ist
+        timer_wheel_add(&ds_expiries, &expiry->timer, ds_current_tick() + ttl * DS_TICKS_PER_SECOND + 1);
     }
+
+    if (!inserted) ds_free_block(&old);
+    return 0;
 }
 
-// Löscht den Pointer zu einem struct aus der Hash Table, wenn eins mit dem gleichen Key gefunden wurde.
-// Außerdem wird das struct explizit selbst gelöscht, weil das nicht von uthash übernommen wird.
+// Löscht den Eintrag mit dem gleichen Key, wenn es einen gibt.
 int ds_delete(bytebuffer *key) {
-    crud_packet *entry = ds_query(key);
+    ds_entry *entry = ds_query(key);
 
     if (!entry) {
         return -1;
-    } else {
-        debug("Deleting entry with key %s and value %s.\n", (char *)key->contents, (char *)entry->value->contents);
-        HASH_DEL(ds_hash_head, entry);
-        free_crud_packet(entry);
     }
 
+    debug("Deleting entry with key %.*s.\n", key->length, (char *)key->contents);
+    ds_remove_entry(entry);
     return 0;
 }
 
-// Löscht alle Pointer zu structs aus der Hash Table, die Hash Table selbst,
-// sowie alle structs, die ihm Hash Table gespeichert waren.
+// Zustand vom Kindprozess beim Umschreiben vom Log
+typedef struct {
+    int fd;
+    uint8_t *buffer;
+    size_t length;
+    uint32_t tick;
+    time_t now;
+} ds_rewriter;
+
+// Nur im Kindprozess: bei einem Fehler ist das Umschreiben gescheitert, der Elternprozess räumt dann auf
+static void ds_rewriter_write(int fd, const uint8_t *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            _exit(EXIT_FAILURE);
+        }
+        bytes += written;
+        length -= written;
+    }
+}
+
+// Schreibt entry als SET Record, so wie er auch im Log stehen würde
+static void ds_rewrite_entry(ds_entry *entry, void *context) {
+    ds_rewriter *rewriter = context;
+    ds_expiry *expiry = ds_entry_expiry(entry);
+    int32_t remaining = expiry != NULL ? (int32_t)(expiry->timer.deadline - rewriter->tick) : 1;
+    if (remaining <= 0) return;
+
+    bytebuffer key = {.contents = (uint8_t *)ds_entry_key(entry), .owner = NULL, .length = entry->key_length};
+    bytebuffer value = {.contents = ds_entry_value(entry), .owner = NULL, .length = entry->value_length};
+    if (entry->flags & DS_ENTRY_SPILLED) {
+        value.contents = malloc(entry->value_length);
+        if (value.contents == NULL || value_file_read(&ds_values, ds_entry_spilled_offset(entry), value.contents, value.length) == -1) _exit(EXIT_FAILURE);
+    }
+    crud_packet record = {.reserved = 0, .action = SET, .key = &key, .value = &value};
+    if (expiry != NULL) {
+        record.reserved = CRUD_FLAG_TTL;
+        record.ttl = rewriter->now + (remaining + DS_TICKS_PER_SECOND - 1) / DS_TICKS_PER_SECOND;
+    }
+
+    size_t length = crud_encoded_size(&record);
+    if (rewriter->length + length > DS_REWRITE_BUFFER_SIZE) {
+        ds_rewriter_write(rewriter->fd, rewriter->buffer, rewriter->length);
+        rewriter->length = 0;
+    }
+    if (length > DS_REWRITE_BUFFER_SIZE) {
+        uint8_t *encoded = malloc(length);
+        if (encoded == NULL) _exit(EXIT_FAILURE);
+        encode_crud_packet(&record, encoded);
+        ds_rewriter_write(rewriter->fd, encoded, length);
+        free(encoded);
+    } else {
+        encode_crud_packet(&record, rewriter->buffer + rewriter->length);
+        rewriter->length += length;
+    }
+    if (entry->flags & DS_ENTRY_SPILLED) free(value.contents);
+}
+
+// Schreibt den Log aus dem aktuellen Stand neu. Das macht ein Kindprozess mit fork(), der den Datastore so sieht,
+// wie er im Moment vom fork() war, ohne dass irgendetwas kopiert werden muss, solange die Event Loop weiterläuft.
+// Alle Records, die der Peer bis zum Ende noch schreibt, sammelt der Log und hängt sie danach an die neue Datei an.
+static void ds_start_log_rewrite() {
+    int fd = append_log_begin_rewrite(&ds_log);
+    if (fd == -1) return;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        warn("Couldn't start rewriting the log: %s\n", strerror(errno));
+        append_log_abort_rewrite(&ds_log, fd);
+        return;
+    }
+
+    // Im Kindprozess gibt es nur noch diesen Thread. Locks vom I/O Thread und stdio sind also tabu, deswegen
+    // auch kein debug() oder panic(), und am Ende _exit() ohne atexit Handler.
+    if (pid == 0) {
+        ds_rewriter rewriter = {.fd = fd, .buffer = malloc(DS_REWRITE_BUFFER_SIZE), .length = 0, .tick = ds_current_tick(), .now = time(NULL)};
+        if (rewriter.buffer == NULL) _exit(EXIT_FAILURE);
+        swiss_foreach(&ds_table, ds_rewrite_entry, &rewriter);
+        ds_rewriter_write(fd, rewriter.buffer, rewriter.length);
+        if (fdatasync(fd) == -1) _exit(EXIT_FAILURE);
+        _exit(EXIT_SUCCESS);
+    }
+
+    if (ds_settings.value_path != NULL) value_file_hold(&ds_values);
+    debug("Rewriting the log with %zu entries in process %d.\n", ds_table.size, pid);
+    ds_rewrite_pid = pid;
+    ds_rewrite_fd = fd;
+    ds_rewrite_requested = 0;
+}
+
+// Schaut nach, ob das Umschreiben vom Log fertig ist oder ob es Zeit für ein neues ist
+static void ds_check_log_rewrite() {
+    if (ds_settings.log_path == NULL) return;
+
+    if (ds_rewrite_pid > 0) {
+        int status;
+        pid_t finished = waitpid(ds_rewrite_pid, &status, WNOHANG);
+        if (finished == 0) return;
+
+        if (finished == ds_rewrite_pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+            debug("Rewritten log is complete, switching over.\n");
+            append_log_finish_rewrite(&ds_log, ds_rewrite_fd);
+        } else {
+            warn("Rewriting the log failed, keeping the old one.\n");
+            append_log_abort_rewrite(&ds_log, ds_rewrite_fd);
+        }
+        if (ds_settings.value_path != NULL) value_file_unhold(&ds_values);
+        ds_rewrite_pid = 0;
+        ds_rewrite_fd = -1;
+        return;
+    }
+
+    if (ds_rewrite_requested || append_log_wants_rewrite(&ds_log, DS_LOG_REWRITE_MIN_SIZE)) ds_start_log_rewrite();
+}
+
+// Schreibt den Log beim nächsten ds_maintenance() neu, egal wie groß er ist
+void ds_request_log_rewrite() {
+    ds_rewrite_requested = 1;
+}
+
+// Private_Dirty aus /proc/<pid>/smaps_rollup in Bytes, 0 wenn es nicht lesbar ist. Bei einem Kindprozess von fork()
+// sind das die Seiten, die nicht mehr mit dem Elternprozess geteilt werden. Ohne stdio, damit es auch der
+// Kindprozess selbst aufrufen kann.
+static size_t ds_private_dirty_bytes(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+
+    char contents[4096];
+    ssize_t length = read(fd, contents, sizeof(contents) - 1);
+    close(fd);
+    if (length <= 0) return 0;
+    contents[length] = '\0';
+
+    const char *field = strstr(contents, "Private_Dirty:");
+    return field != NULL ? strtoull(field + strlen("Private_Dirty:"), NULL, 10) * 1024 : 0;
+}
+
+// Schreibt einen Snapshot aus einem Kindprozess mit fork(), wie beim Umschreiben vom Log. Der Kindprozess sieht den
+// Datastore so, wie er beim fork() war, und der Peer arbeitet weiter, ohne auf die Platte zu warten. Nur Seiten,
+// die der Peer währenddessen ändert, werden kopiert. Der Log wird danach nicht gekürzt: Er wird beim Start über
+// den Snapshot abgespielt, und SET und DEL ein zweites Mal anzuwenden ändert am Ergebnis nichts.
+static void ds_start_snapshot() {
+    ds_snapshot_started_ms = ds_monotonic_ms();
+    ds_snapshot_started = ds_snapshot_started_ms / DS_EXPIRY_TICK;
+    ds_snapshot_requested = 0;
+    ds_snapshot_changes = 0;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        warn("Couldn't start writing a snapshot: %s\n", strerror(errno));
+        return;
+    }
+
+    // Gleiche Regeln wie beim Umschreiben vom Log: kein stdio, keine Locks, _exit()
+    if (pid == 0) {
+        int result = snapshot_write(&ds_table, ds_settings.snapshot_path, ds_current_tick(), DS_TICKS_PER_SECOND, ds_settings.value_path != NULL ? &ds_values : NULL, ds_snapshot_progress);
+        ds_snapshot_progress->copied_bytes = ds_private_dirty_bytes(getpid());
+        _exit(result == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (ds_settings.value_path != NULL) value_file_hold(&ds_values);
+    debug("Writing snapshot with %zu entries in process %d.\n", ds_table.size, pid);
+    ds_snapshot_pid = pid;
+}
+
+// Schaut nach, ob der Snapshot im Hintergrund fertig ist oder ob es Zeit für einen neuen ist
+static void ds_check_snapshot() {
+    if (ds_settings.snapshot_path == NULL) return;
+
+    if (ds_snapshot_pid > 0) {
+        int status;
+        pid_t finished = waitpid(ds_snapshot_pid, &status, WNOHANG);
+        if (finished == 0) return;
+
+        if (finished == ds_snapshot_pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+            debug("Snapshot with %lu bytes written after %lu ms, %lu bytes were copied on write.\n", (unsigned long)ds_snapshot_progress->written,
+                  (unsigned long)(ds_monotonic_ms() - ds_snapshot_started_ms), (unsigned long)ds_snapshot_progress->copied_bytes);
+        } else {
+            warn("Writing the snapshot failed, keeping the old one.\n");
+        }
+        if (ds_settings.value_path != NULL) value_file_unhold(&ds_values);
+        ds_snapshot_pid = 0;
+        return;
+    }
+
+    // Regelmäßig nur, wenn sich seit dem letzten Snapshot auch etwas geändert hat
+    uint32_t interval = ds_settings.snapshot_interval * DS_TICKS_PER_SECOND;
+    int due = interval > 0 && ds_snapshot_changes > 0 && ds_current_tick() - ds_snapshot_started >= interval;
+    // Der Kindprozess kann nur current schreiben. Solange der Index noch umzieht, wartet der Snapshot, bis
+    // ds_maintenance() damit fertig ist, statt den Rest auf einmal in der Event Loop umzuziehen.
+    if ((ds_snapshot_requested || due) && ds_table.previous.capacity == 0) ds_start_snapshot();
+}
+
+// Schreibt beim nächsten ds_maintenance() einen Snapshot im Hintergrund
+void ds_request_snapshot() {
+    ds_snapshot_requested = 1;
+}
+
+// Wird regelmäßig aus der Event Loop aufgerufen und zieht bei einer laufenden Vergrößerung vom Index
+// noch ein Stück mehr um, damit sie auch fertig wird, wenn gerade kaum Anfragen kommen.
+// Außerdem wird das Timer-Rad bis zur aktuellen Zeit weitergedreht, dabei verschwinden alle abgelaufenen Einträge,
+// wenn der Log zu groß geworden ist, wird er im Hintergrund neu geschrieben, und fällige Snapshots werden angestoßen.
+void ds_maintenance(void *context) {
+    swiss_rehash_step(&ds_table, DS_IDLE_REHASH_SLOTS);
+    timer_wheel_advance(&ds_expiries, ds_current_tick(), ds_expire, NULL);
+    ds_check_log_rewrite();
+    ds_check_snapshot();
+}
+
+// eventfd vom Log, das lesbar wird, sobald wieder Records gesynct wurden. -1 ohne Log.
+int ds_log_notify_fd() {
+    return ds_settings.log_path != NULL ? ds_log.notify_fd : -1;
+}
+
+uint64_t ds_log_durable() {
+    return append_log_durable(&ds_log);
+}
+
+static void ds_release_entry(ds_entry *entry) {
+    if (!(entry->flags & DS_ENTRY_MAPPED)) slab_free(&ds_slab, entry->block, ds_entry_block_size(entry));
+}
+
+// Resident Set Size vom ganzen Prozess in Bytes, oder 0, wenn /proc nicht lesbar ist
+static size_t ds_resident_bytes() {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) return 0;
+
+    size_t total_pages = 0, resident_pages = 0;
+    int matched = fscanf(statm, "%zu %zu", &total_pages, &resident_pages);
+    fclose(statm);
+    return matched == 2 ? resident_pages * sysconf(_SC_PAGESIZE) : 0;
+}
+
+// Schreibt den Speicherverbrauch vom Datastore nach stderr. Overhead ist alles, was Index und Slabs über die
+// eigentlichen Keys und Values hinaus belegen, also leere Slots, Kontrollbytes und Verschnitt in den Größenklassen.
+void ds_print_stats() {
+    size_t index_bytes = swiss_memory_usage(&ds_table);
+    size_t payload_bytes = ds_slab.requested_bytes;
+    size_t allocated_bytes = index_bytes + ds_slab.slab_bytes + ds_slab.extent_bytes;
+
+    fprintf(stderr, "[%s] datastore: %zu entries, %zu payload bytes in blocks, %zu index bytes, %zu slab bytes, %zu extent bytes\n", dbg_identifier, ds_table.size, payload_bytes, index_bytes, ds_slab.slab_bytes, ds_slab.extent_bytes);
+    if (ds_table.size > 0) {
+        fprintf(stderr, "[%s] datastore: %.1f bytes overhead per entry, process RSS %zu bytes\n", dbg_identifier, (double)(allocated_bytes - payload_bytes) / ds_table.size, ds_resident_bytes());
+    }
+    fprintf(stderr, "[%s] datastore: %zu of %zu bytes used (0 = no limit), %zu hits, %zu misses, %zu evictions (%zu bytes), %zu not admitted\n", dbg_identifier, ds_used_bytes, ds_settings.memory_limit, ds_stats.hits, ds_stats.misses, ds_stats.evictions, ds_stats.evicted_bytes, ds_stats.admission_rejects);
+    fprintf(stderr, "[%s] datastore: %zu entries with TTL, %zu expired, %zu snapshot bytes mapped\n", dbg_identifier, ds_expiries.count, ds_stats.expirations, ds_snapshot.length);
+    if (ds_settings.value_path != NULL) {
+        fprintf(stderr, "[%s] datastore: %lu value bytes on disk (%lu released), %zu cold values spilled (%zu bytes), %zu reads from disk\n", dbg_identifier,
+                (unsigned long)ds_values.live_bytes, (unsigned long)ds_values.released_bytes, ds_stats.spills, ds_stats.spilled_bytes, ds_stats.disk_reads);
+    }
+    if (ds_snapshot_pid > 0) {
+        fprintf(stderr, "[%s] datastore: snapshot in process %d: %lu of %lu bytes written, %zu bytes copied on write so far\n", dbg_identifier, ds_snapshot_pid,
+                (unsigned long)ds_snapshot_progress->written, (unsigned long)ds_snapshot_progress->total, ds_private_dirty_bytes(ds_snapshot_pid));
+    }
+}
+
+// Löscht alle Einträge und den Index selbst. Ausstehende Records im Log werden vorher noch geschrieben,
+// und mit Snapshot landet der ganze Stand darin.
 void ds_destruct() {
-    debug("Deleting complete data store!\n");
-    crud_packet *current, *tmp;
+    if (ds_rewrite_pid > 0) {
+        kill(ds_rewrite_pid, SIGKILL);
+        waitpid(ds_rewrite_pid, NULL, 0);
+        append_log_abort_rewrite(&ds_log, ds_rewrite_fd);
+    }
+    if (ds_snapshot_pid > 0) {
+        kill(ds_snapshot_pid, SIGKILL);
+        waitpid(ds_snapshot_pid, NULL, 0);
+    }
+    if (ds_settings.log_path != NULL) append_log_close(&ds_log);
 
-    HASH_ITER(hh, ds_hash_head, current, tmp) {
-        HASH_DEL(ds_hash_head, current);
-        free_crud_packet(current);
+    // Steht alles im Snapshot, braucht es den Log nicht mehr. Stürzt der Peer vor dem Kürzen ab, wird der Log beim
+    // nächsten Start eben noch einmal über den gleichen Stand abgespielt.
+    if (ds_settings.snapshot_path != NULL) {
+        // Der Peer hört hier sowieso auf, da darf der Rest vom Umzug auf einmal passieren
+        swiss_finish_rehash(&ds_table);
+        if (snapshot_write(&ds_table, ds_settings.snapshot_path, ds_current_tick(), DS_TICKS_PER_SECOND, ds_settings.value_path != NULL ? &ds_values : NULL, NULL) == -1) {
+            warn("Couldn't write snapshot %s: %s\n", ds_settings.snapshot_path, strerror(errno));
+        } else if (ds_settings.log_path != NULL && truncate(ds_settings.log_path, 0) == -1) {
+            warn("Couldn't truncate log %s: %s\n", ds_settings.log_path, strerror(errno));
+        }
     }
+
+    if (ds_settings.value_path != NULL) value_file_close(&ds_values);
+
+    debug("Deleting complete data store with %zu entries!\n", ds_table.size);
+    swiss_destruct(&ds_table, ds_release_entry);
+    slab_destruct(&ds_slab);
+    if (ds_snapshot.base != NULL) snapshot_unmap(&ds_snapshot);
+    if (ds_snapshot_progress != NULL) munmap(ds_snapshot_progress, sizeof(snapshot_progress));
+    free(ds_doorkeeper);
 }
\ No newline at end of file
@@ -1,13 +1,105 @@
 #ifndef DATASTORE_H
 #define DATASTORE_H
 
+#include "uthash.h"
 #include "protocol.h"
+#include "swisstable.h"
+#include "slab.h"
+#include "appendlog.h"
+#include "snapshot.h"
+
+// So oft läuft ds_maintenance() in der Event Loop
+#define DS_MAINTENANCE_INTERVAL 10
+// So viele Slots zieht jeder Durchlauf von ds_maintenance() bei einer Vergrößerung vom Index um
+#define DS_IDLE_REHASH_SLOTS 4096
+// Auflösung der Ablaufzeiten in Millisekunden. Das Timer-Rad wird in ds_maintenance() weitergedreht.
+#define DS_EXPIRY_TICK 100
+#define DS_TICKS_PER_SECOND (1000 / DS_EXPIRY_TICK)
+// Deadlines werden mit Vorzeichen verglichen, längere TTLs werden auf das hier gekürzt (etwa 6 Jahre)
+#define DS_MAX_TTL (INT32_MAX / DS_TICKS_PER_SECOND - 1)
+
+// Der Log wird frühestens ab dieser Größe umgeschrieben, und dann immer, wenn er sich seitdem verdoppelt hat
+#define DS_LOG_REWRITE_MIN_SIZE (64 * 1024 * 1024)
+// Puffer, mit dem der Kindprozess beim Umschreiben vom Log schreibt
+#define DS_REWRITE_BUFFER_SIZE (256 * 1024)
+
+// Values ab dieser Größe kommen mit Value-Datei sofort dorthin, wenn mit -t nichts anderes angegeben ist
+#define DS_DEFAULT_SPILL_THRESHOLD (64 * 1024)
+// Bei vollem Speicher werden nur Values ab dieser Größe ausgelagert, kleinere werden gleich verdrängt.
+// Für ein paar hundert Bytes lohnt sich ein Lesen von der Platte bei jedem GET nicht.
+#define DS_COLD_SPILL_MIN_SIZE 1024
+// So viele schon ausgelagerte Einträge überspringt das Verdrängen höchstens, bevor es doch einen davon nimmt
+#define DS_SPILL_SEARCH_LIMIT 64
+// Ausgelagerte Values ab dieser Größe liest ein GET nicht mehr ein, die Antwort geht mit sendfile() direkt aus der Datei raus
+#define DS_SENDFILE_MIN_SIZE (16 * 1024)
+
+// So viele freigegebene ds_pin werden für die nächsten GETs aufgehoben
+#define DS_PIN_CACHE_SIZE 256
+
+// Größe vom Bitfeld für die Zulassung (128 KiB)
+#define DS_DOORKEEPER_SHIFT 20
+#define DS_DOORKEEPER_BITS (1u << DS_DOORKEEPER_SHIFT)
+
+typedef struct {
+    size_t memory_limit;  // in Bytes, 0 = kein Limit
+    unsigned int admission : 1;  // bei vollem Speicher nur Keys aufnehmen, die kurz vorher schon einmal geschrieben wurden
+    const char* log_path;  // Append-only Log, NULL = nichts wird gespeichert
+    log_fsync_policy fsync_policy;
+    int fsync_interval;  // in Millisekunden, nur bei LOG_FSYNC_INTERVAL
+    const char* snapshot_path;  // wird beim Start gemappt und beim Beenden neu geschrieben, NULL = kein Snapshot
+    unsigned int snapshot_interval;  // in Sekunden, so oft wird zusätzlich im Hintergrund ein Snapshot geschrieben, 0 = nie
+    const char* value_path;  // Datei für ausgelagerte Values, NULL = alles bleibt im Speicher
+    size_t spill_threshold;  // Values ab dieser Größe werden sofort ausgelagert
+} ds_config;
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t evicted_bytes;
+    size_t admission_rejects;
+    size_t expirations;
+    size_t spills;  // Values, die bei vollem Speicher ausgelagert statt verdrängt wurden
+    size_t spilled_bytes;
+    size_t disk_reads;
+} ds_counters;
+
+// Referenz auf den Block von einem Eintrag, die Antworten auf GET festhalten, bis sie verschickt sind.
+// Ändert sich der Eintrag vorher, wird er gelöscht, verdrängt oder ausgelagert, bleibt der alte Block so lange liegen.
+// Ein GET muss das Value also nie kopieren, auch wenn seine Antwort noch hinter anderen in der Warteschlange steht.
+// Alle Antworten auf den gleichen Block teilen sich einen ds_pin, nur im Hauptthread benutzen.
+typedef struct ds_pin {
+    shared_bytes shared;  // muss vorne stehen, release() bekommt nur den Pointer darauf
+    uint8_t* block;
+    size_t size;                // Größe vom Block für slab_free()
+    unsigned int mapped : 1;    // Block liegt im Snapshot und muss nicht freigegeben werden
+    unsigned int orphaned : 1;  // der Eintrag hat den Block schon abgegeben, er wird mit der letzten Referenz freigegeben
+    UT_hash_handle hh;          // in ds_pins nach block, solange der Block noch zum Eintrag gehört
+    struct ds_pin* next_free;
+} ds_pin;
+
+// Das gleiche für ausgelagerte Values, deren Antworten mit sendfile() direkt aus der Value-Datei kommen.
+// Gesperrt wird nur der Bereich vom Value, alles andere in der Datei kann weiter gelocht werden.
+typedef struct ds_value_pin {
+    shared_bytes shared;  // muss vorne stehen, release() bekommt nur den Pointer darauf
+    uint64_t offset;
+    uint32_t length;
+    unsigned int orphaned : 1;  // der Eintrag hat das Value schon abgegeben, es wird mit der letzten Referenz freigegeben
+    UT_hash_handle hh;          // in ds_value_pins nach offset, solange das Value noch zum Eintrag gehört
+} ds_value_pin;
 
 // database-specific functions
-crud_packet* execute_ds_action(crud_packet* pkg);
-crud_packet* ds_query(bytebuffer* key);
-void ds_set(crud_packet* pkg);
+void ds_initialize(ds_config* config);
+crud_packet* execute_ds_action(crud_packet* pkg, uint64_t* log_position);
+ds_entry* ds_query(bytebuffer* key);
+int ds_set(crud_packet* pkg);
 int ds_delete(bytebuffer* key);
+void ds_maintenance(void* context);
+int ds_log_notify_fd();
+void ds_request_log_rewrite();
+void ds_request_snapshot();
+uint64_t ds_log_durable();
+void ds_print_stats();
 void ds_destruct();
 
 #endif
\ No newline at end of file
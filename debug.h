@@ -7,7 +7,7 @@
 #include <stdarg.h>
 #include <execinfo.h>
 
-char* dbg_identifier;
+extern char* dbg_identifier;
 static char* debug_color = "\033[94m";
 static char* warn_color = "\033[33;1m";
 static char* panic_color = "\033[31;1m";
@@ -0,0 +1,58 @@
+#include "finger.h"
+#include "debug.h"
+
+// Am Anfang ist nur der Nachfolger bekannt. Der ist sicher für den ersten Finger (eigene ID + 1) zuständig,
+// alle anderen Einträge werden erst durch die periodischen Lookups in fix_fingers gefüllt.
+void finger_table_initialize(finger_table* ft, peer* self, peer* successor) {
+    ft->self_id = self->node_id;
+    ft->next_to_fix = 1;
+
+    for (int i = 0; i < FINGER_COUNT; i++) {
+        ft->entries[i].start = (uint16_t)(self->node_id + (1u << i));
+        ft->entries[i].valid = 0;
+    }
+
+    ft->entries[0].node = *successor;
+    ft->entries[0].valid = 1;
+}
+
+// Prüft, ob hash_value im Ring echt zwischen from und to liegt (beide Grenzen ausgeschlossen).
+// Der Bereich darf über 0 hinweg gehen, genauso wie bei peer_stores_hashvalue().
+int hash_in_open_interval(uint16_t hash_value, uint16_t from, uint16_t to) {
+    if (from < to) return hash_value > from && hash_value < to;
+    if (from > to) return hash_value > from || hash_value < to;
+    return hash_value != from;  // from == to: der ganze Ring außer from selbst
+}
+
+// Sucht den Finger, der im Ring am nächsten vor hash_value liegt. An den wird ein LOOKUP weitergeschickt,
+// dadurch halbiert sich der restliche Abstand mit jedem Schritt und ein Lookup braucht nur noch O(log N) Hops.
+// Gibt es keinen passenden Finger, wird der Nachfolger zurückgegeben, das entspricht dem alten Verhalten.
+peer* finger_closest_preceding(finger_table* ft, uint16_t hash_value) {
+    for (int i = FINGER_COUNT - 1; i >= 0; i--) {
+        finger_entry* entry = &ft->entries[i];
+        if (entry->valid && hash_in_open_interval(entry->node.node_id, ft->self_id, hash_value)) {
+            return &entry->node;
+        }
+    }
+
+    return &ft->entries[0].node;
+}
+
+// Gibt den Index vom Finger zurück, der als nächstes nachgeschlagen werden soll. Finger 0 ist immer der Nachfolger.
+int finger_next_to_fix(finger_table* ft) {
+    int index = ft->next_to_fix;
+    ft->next_to_fix = ft->next_to_fix + 1 < FINGER_COUNT ? ft->next_to_fix + 1 : 1;
+    return index;
+}
+
+void finger_update(finger_table* ft, int index, uint16_t node_id, uint32_t node_ip, uint16_t node_port) {
+    finger_entry* entry = &ft->entries[index];
+    if (!entry->valid || entry->node.node_id != node_id) {
+        debug("Finger %d (start %#x) now points to node %#x.\n", index, entry->start, node_id);
+    }
+
+    entry->node.node_id = node_id;
+    entry->node.node_ip = node_ip;
+    entry->node.node_port = node_port;
+    entry->valid = 1;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef FINGER_H
+#define FINGER_H
+
+#include <stdint.h>
+#include "protocol.h"
+
+// Der Identifier-Raum hat 2^16 Werte, also gibt es 16 Finger.
+#define FINGER_COUNT 16
+// So oft wird ein Finger neu nachgeschlagen. Nach FINGER_COUNT Ticks ist die ganze Tabelle einmal aktualisiert.
+#define FIX_FINGERS_INTERVAL 250
+
+// Eintrag i zeigt auf den Peer, der für start = eigene ID + 2^i zuständig ist (also successor(start)).
+typedef struct {
+    uint16_t start;
+    peer node;
+    uint valid : 1;
+} finger_entry;
+
+typedef struct {
+    uint16_t self_id;
+    finger_entry entries[FINGER_COUNT];
+    int next_to_fix;
+} finger_table;
+
+void finger_table_initialize(finger_table* ft, peer* self, peer* successor);
+int hash_in_open_interval(uint16_t hash_value, uint16_t from, uint16_t to);
+peer* finger_closest_preceding(finger_table* ft, uint16_t hash_value);
+int finger_next_to_fix(finger_table* ft);
+void finger_update(finger_table* ft, int index, uint16_t node_id, uint32_t node_ip, uint16_t node_port);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <string.h>
+#include <endian.h>
+#include "hash.h"
+
+#define XXH_PRIME32_1 0x9E3779B1u
+#define XXH_PRIME32_2 0x85EBCA77u
+#define XXH_PRIME32_3 0xC2B2AE3Du
+#define XXH_PRIME32_4 0x27D4EB2Fu
+#define XXH_PRIME32_5 0x165667B1u
+
+static inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+// Beide Hashfunktionen lesen die Bytes als Little Endian, damit auf jeder Maschine der gleiche Wert herauskommt
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return le32toh(value);
+}
+
+static inline uint32_t xxh32_round(uint32_t accumulator, uint32_t lane) {
+    accumulator += lane * XXH_PRIME32_2;
+    accumulator = rotl32(accumulator, 13);
+    return accumulator * XXH_PRIME32_1;
+}
+
+// xxHash32, siehe https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+uint32_t xxh32(const uint8_t* data, size_t length, uint32_t seed) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + length;
+    uint32_t h;
+
+    if (length >= 16) {
+        uint32_t v1 = seed + XXH_PRIME32_1 + XXH_PRIME32_2;
+        uint32_t v2 = seed + XXH_PRIME32_2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - XXH_PRIME32_1;
+
+        for (; p + 16 <= end; p += 16) {
+            v1 = xxh32_round(v1, read32(p));
+            v2 = xxh32_round(v2, read32(p + 4));
+            v3 = xxh32_round(v3, read32(p + 8));
+            v4 = xxh32_round(v4, read32(p + 12));
+        }
+        h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    } else {
+        h = seed + XXH_PRIME32_5;
+    }
+
+    h += (uint32_t)length;
+
+    for (; p + 4 <= end; p += 4) {
+        h += read32(p) * XXH_PRIME32_3;
+        h = rotl32(h, 17) * XXH_PRIME32_4;
+    }
+    for (; p < end; p++) {
+        h += (*p) * XXH_PRIME32_5;
+        h = rotl32(h, 11) * XXH_PRIME32_1;
+    }
+
+    h ^= h >> 15;
+    h *= XXH_PRIME32_2;
+    h ^= h >> 13;
+    h *= XXH_PRIME32_3;
+    h ^= h >> 16;
+    return h;
+}
+
+// MurmurHash3_x86_32 von Austin Appleby
+uint32_t murmur3_32(const uint8_t* data, size_t length, uint32_t seed) {
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h = seed;
+    size_t blocks = length / 4;
+
+    for (size_t i = 0; i < blocks; i++) {
+        uint32_t k = read32(data + i * 4);
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+
+        h ^= k;
+        h = rotl32(h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
+
+    const uint8_t* tail = data + blocks * 4;
+    uint32_t k = 0;
+    switch (length & 3) {
+        case 3:
+            k ^= tail[2] << 16;
+            // fall through
+        case 2:
+            k ^= tail[1] << 8;
+            // fall through
+        case 1:
+            k ^= tail[0];
+            k *= c1;
+            k = rotl32(k, 15);
+            k *= c2;
+            h ^= k;
+    }
+
+    h ^= (uint32_t)length;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t hash_key(const uint8_t* key, size_t length) {
+#if defined(KEY_HASH_MURMUR3)
+    return murmur3_32(key, length, KEY_HASH_SEED);
+#else
+    return xxh32(key, length, KEY_HASH_SEED);
+#endif
+}
+
+// Bildet den ganzen Key auf eine Position im 16 Bit Identifier-Raum vom Ring ab. Die oberen 16 Bit vom Hash
+// sind genauso gut durchmischt wie die unteren, so hängt die Position von jedem Byte im Key ab und nicht nur vom Präfix.
+uint16_t hash_key_to_ring(const uint8_t* key, size_t length) {
+    return (uint16_t)(hash_key(key, length) >> 16);
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Welche Hashfunktion benutzt wird, wird beim Bauen über KEY_HASH in CMakeLists.txt festgelegt.
+// Client und alle Peers müssen mit der gleichen Funktion gebaut sein, sonst landen Keys beim falschen Peer.
+#if !defined(KEY_HASH_XXH32) && !defined(KEY_HASH_MURMUR3)
+#define KEY_HASH_XXH32
+#endif
+
+#define KEY_HASH_SEED 0
+
+uint32_t xxh32(const uint8_t* data, size_t length, uint32_t seed);
+uint32_t murmur3_32(const uint8_t* data, size_t length, uint32_t seed);
+uint32_t hash_key(const uint8_t* key, size_t length);
+uint16_t hash_key_to_ring(const uint8_t* key, size_t length);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "parser.h"
+#include "debug.h"
+
+// Bereitet den Parser auf das nächste Kontrollbyte vor. Ohne target bleiben die Bytes im Slab liegen,
+// es müssen nur expected viele am Stück ab buffer_start da sein.
+static void parser_expect(packet_parser* p, parser_state state, uint8_t* target, uint32_t expected) {
+    p->state = state;
+    p->target = target;
+    p->expected = expected;
+    p->received = 0;
+}
+
+// Fängt mit dem nächsten Paket an, Bytes im Slab bleiben dabei erhalten
+static void parser_reset(packet_parser* p) {
+    p->packet.contents = NULL;
+    p->packet.type = PROTO_UNDEF;
+    parser_expect(p, PARSE_CONTROL, &p->control, 1);
+}
+
+void parser_initialize(packet_parser* p) {
+    parser_reset(p);
+    p->slab = shared_block_create(PARSER_BUFFER_SIZE);
+    p->buffer_start = 0;
+    p->buffer_end = 0;
+    p->drained = 0;
+}
+
+// Nach Header und Erweiterungsfeldern kommen Key und Value. Passen beide zusammen in einen Slab, werden sie dort
+// nur gesammelt und das Paket zeigt hinein. Nur größere bekommen eigenen Speicher und werden dort hineingelesen.
+static void parser_expect_fields(packet_parser* p, crud_packet* pkg) {
+    uint64_t length = (uint64_t)pkg->key->length + pkg->value->length;
+    if (length <= PARSER_BUFFER_SIZE) {
+        parser_expect(p, PARSE_CRUD_FIELDS, NULL, length);
+        return;
+    }
+
+    bytebuffer_allocate(pkg->key, pkg->key->length);
+    parser_expect(p, PARSE_CRUD_KEY, pkg->key->contents, pkg->key->length);
+}
+
+// Wechselt in den nächsten Zustand, nachdem alle Bytes für den aktuellen Zustand angekommen sind.
+// Gibt PARSER_COMPLETE zurück, wenn das Paket damit fertig ist.
+static parser_status parser_advance(packet_parser* p, int fd) {
+    switch (p->state) {
+        case PARSE_CONTROL: {
+            p->packet.type = (p->control & 0x80) >> 7;
+
+            if (p->packet.type == PROTO_CRUD) {
+                crud_packet* pkg = get_blank_crud_packet();
+                parse_crud_control(fd, pkg, &p->control);
+                p->packet.contents = pkg;
+                if (!crud_action_is_valid(pkg->action)) {
+                    warn("Illegal request parameter %#x on socket %d.\n", pkg->action, fd);
+                    return PARSER_ERROR;
+                }
+                parser_expect(p, PARSE_CRUD_HEADER, p->scratch, CRUD_HEADER_SIZE);
+            } else {
+                chord_packet* pkg = get_blank_chord_packet();
+                parse_chord_control(fd, pkg, &p->control);
+                p->packet.contents = pkg;
+                parser_expect(p, PARSE_CHORD_BODY, p->scratch, CHORD_PACKET_SIZE);
+            }
+            return PARSER_INCOMPLETE;
+        }
+        case PARSE_CRUD_HEADER: {
+            crud_packet* pkg = p->packet.contents;
+            decode_crud_header(pkg, p->scratch);
+            if (crud_extension_size(pkg) > 0) {
+                parser_expect(p, PARSE_CRUD_EXTENSION, p->scratch, crud_extension_size(pkg));
+                return PARSER_INCOMPLETE;
+            }
+            parser_expect_fields(p, pkg);
+            return PARSER_INCOMPLETE;
+        }
+        case PARSE_CRUD_EXTENSION: {
+            crud_packet* pkg = p->packet.contents;
+            decode_crud_extensions(pkg, p->scratch);
+            parser_expect_fields(p, pkg);
+            return PARSER_INCOMPLETE;
+        }
+        case PARSE_CRUD_FIELDS: {
+            crud_packet* pkg = p->packet.contents;
+            uint8_t* fields = p->slab->bytes + p->buffer_start;
+            if (pkg->key->length > 0) bytebuffer_share(pkg->key, &p->slab->shared, fields, pkg->key->length);
+            if (pkg->value->length > 0) bytebuffer_share(pkg->value, &p->slab->shared, fields + pkg->key->length, pkg->value->length);
+            p->buffer_start += p->expected;
+            debug("Got CRUD packet with action %#x\nKey: %.*s\nValue: %.*s\n", pkg->action, pkg->key->length, (char*)pkg->key->contents, pkg->value->length, (char*)pkg->value->contents);
+            return PARSER_COMPLETE;
+        }
+        case PARSE_CRUD_KEY: {
+            crud_packet* pkg = p->packet.contents;
+            bytebuffer_allocate(pkg->value, pkg->value->length);
+            parser_expect(p, PARSE_CRUD_VALUE, pkg->value->contents, pkg->value->length);
+            return PARSER_INCOMPLETE;
+        }
+        case PARSE_CRUD_VALUE: {
+            crud_packet* pkg = p->packet.contents;
+            debug("Got CRUD packet with action %#x\nKey: %.*s\nValue: %.*s\n", pkg->action, pkg->key->length, (char*)pkg->key->contents, pkg->value->length, (char*)pkg->value->contents);
+            return PARSER_COMPLETE;
+        }
+        case PARSE_CHORD_BODY: {
+            chord_packet* pkg = p->packet.contents;
+            decode_chord_body(pkg, p->scratch);
+            if (chord_extension_size(pkg) > 0) {
+                parser_expect(p, PARSE_CHORD_EXTENSION, p->scratch, chord_extension_size(pkg));
+                return PARSER_INCOMPLETE;
+            }
+            debug("Got chord packet with action = %#x, Hash ID = %#x from socket %d.\n", pkg->action, pkg->hash_id, fd);
+            return PARSER_COMPLETE;
+        }
+        case PARSE_CHORD_EXTENSION: {
+            chord_packet* pkg = p->packet.contents;
+            decode_chord_extensions(pkg, p->scratch);
+            debug("Got chord packet with action = %#x, Request ID = %u, Hash ID = %#x from socket %d.\n", pkg->action, pkg->request_id, pkg->hash_id, fd);
+            return PARSER_COMPLETE;
+        }
+    }
+
+    return PARSER_ERROR;
+}
+
+// Sorgt dafür, dass ab buffer_start needed Bytes am Stück in den Slab passen und hinten noch Platz zum Lesen ist.
+// Hängt kein Paket mehr am Slab, werden die unverbrauchten Bytes einfach nach vorne geschoben. Sonst zeigen noch
+// Keys oder Values hinein, dann kommen die unverbrauchten Bytes in einen neuen Slab, und der alte lebt so lange
+// weiter, bis das letzte Paket darauf freigegeben wurde.
+static void parser_make_room(packet_parser* p, uint32_t needed) {
+    uint32_t unconsumed = p->buffer_end - p->buffer_start;
+    int exclusive = shared_bytes_is_exclusive(&p->slab->shared);
+    if (unconsumed == 0 && exclusive) {
+        p->buffer_start = 0;
+        p->buffer_end = 0;
+        return;
+    }
+    if (p->buffer_start + needed <= PARSER_BUFFER_SIZE && p->buffer_end < PARSER_BUFFER_SIZE) return;
+
+    if (exclusive) {
+        memmove(p->slab->bytes, p->slab->bytes + p->buffer_start, unconsumed);
+    } else {
+        shared_block* fresh = shared_block_create(PARSER_BUFFER_SIZE);
+        memcpy(fresh->bytes, p->slab->bytes + p->buffer_start, unconsumed);
+        shared_bytes_release(&p->slab->shared);
+        p->slab = fresh;
+    }
+    p->buffer_start = 0;
+    p->buffer_end = unconsumed;
+}
+
+// Ein recv() nach destination. Bei PARSER_COMPLETE wurde etwas gelesen und steht in *received_bytes.
+static parser_status parser_recv(packet_parser* p, int fd, uint8_t* destination, size_t space, size_t* received_bytes) {
+    // Hat das letzte recv() den Socket leer gelesen, kommt beim nächsten nur EAGAIN. Level-triggered epoll
+    // meldet sich sowieso wieder, sobald neue Bytes da sind, der Syscall kann also gespart werden.
+    if (p->drained) {
+        p->drained = 0;
+        return PARSER_INCOMPLETE;
+    }
+
+    while (1) {
+        ssize_t result = recv(fd, destination, space, MSG_DONTWAIT);
+        if (result > 0) {
+            p->drained = (size_t)result < space;
+            *received_bytes = result;
+            return PARSER_COMPLETE;
+        }
+
+        if (result == 0) {
+            if (p->state == PARSE_CONTROL) return PARSER_CLOSED;
+            warn("Connection on socket %d was closed in the middle of a packet.\n", fd);
+            return PARSER_ERROR;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return PARSER_INCOMPLETE;
+        if (errno == EINTR) continue;
+        warn("%s\n", strerror(errno));
+        return PARSER_ERROR;
+    }
+}
+
+// Füllt den aktuellen Zustand aus dem Slab und liest nach, wenn dort nicht genug steht. Gibt PARSER_COMPLETE zurück,
+// sobald alle Bytes für den Zustand da sind, sonst wie parser_receive().
+static parser_status parser_fill(packet_parser* p, int fd) {
+    size_t received_bytes;
+
+    // Key und Value werden nicht kopiert, sie müssen nur komplett im Slab stehen
+    if (p->target == NULL) {
+        while (p->buffer_end - p->buffer_start < p->expected) {
+            parser_make_room(p, p->expected);
+            parser_status status = parser_recv(p, fd, p->slab->bytes + p->buffer_end, PARSER_BUFFER_SIZE - p->buffer_end, &received_bytes);
+            if (status != PARSER_COMPLETE) return status;
+            p->buffer_end += received_bytes;
+        }
+        p->received = p->expected;
+        return PARSER_COMPLETE;
+    }
+
+    while (p->received < p->expected) {
+        uint32_t missing = p->expected - p->received;
+        uint32_t buffered = p->buffer_end - p->buffer_start;
+        if (buffered > 0) {
+            uint32_t taken = buffered < missing ? buffered : missing;
+            memcpy(p->target + p->received, p->slab->bytes + p->buffer_start, taken);
+            p->buffer_start += taken;
+            p->received += taken;
+            continue;
+        }
+
+        // Große Felder direkt an ihr Ziel, alles andere erst in den Slab
+        if (missing >= PARSER_BUFFER_SIZE) {
+            parser_status status = parser_recv(p, fd, p->target + p->received, missing, &received_bytes);
+            if (status != PARSER_COMPLETE) return status;
+            p->received += received_bytes;
+            continue;
+        }
+
+        parser_make_room(p, 1);
+        parser_status status = parser_recv(p, fd, p->slab->bytes + p->buffer_end, PARSER_BUFFER_SIZE - p->buffer_end, &received_bytes);
+        if (status != PARSER_COMPLETE) return status;
+        p->buffer_end += received_bytes;
+    }
+    return PARSER_COMPLETE;
+}
+
+// Baut aus den Bytes von fd Stück für Stück ein Paket. Sobald ein Paket komplett ist, landet es in *out, und der
+// Parser fängt beim nächsten Aufruf mit einem neuen an. Bytes, die schon zum nächsten Paket gehören, bleiben im Slab,
+// der Aufrufer muss also so lange weitermachen, bis PARSER_INCOMPLETE kommt.
+// Key und Value von CRUD Paketen zeigen meistens in den Slab, gültig bleiben sie trotzdem bis free_crud_packet().
+// Der Socket darf blockierend sein, gelesen wird hier immer mit MSG_DONTWAIT.
+parser_status parser_receive(packet_parser* p, int fd, generic_packet* out) {
+    while (1) {
+        parser_status filled = parser_fill(p, fd);
+        if (filled != PARSER_COMPLETE) return filled;
+
+        parser_status status = parser_advance(p, fd);
+        if (status == PARSER_COMPLETE) {
+            *out = p->packet;
+            parser_reset(p);
+            return PARSER_COMPLETE;
+        }
+        if (status == PARSER_ERROR) return PARSER_ERROR;
+    }
+}
+
+// Gibt den Slab und ein halb angekommenes Paket frei, zB. wenn die Verbindung mittendrin geschlossen wurde
+void parser_destruct(packet_parser* p) {
+    shared_bytes_release(&p->slab->shared);
+    p->slab = NULL;
+
+    if (p->packet.contents != NULL) {
+        if (p->packet.type == PROTO_CRUD) {
+            free_crud_packet(p->packet.contents);
+        } else {
+            free(p->packet.contents);
+        }
+    }
+    parser_reset(p);
+}
\ No newline at end of file
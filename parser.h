@@ -0,0 +1,53 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdint.h>
+#include "bytebuffer.h"
+#include "protocol.h"
+
+// So viel holt ein recv() höchstens auf einmal in den Slab vom Parser. Key und Value, die zusammen größer sind,
+// bekommen eigenen Speicher, und Felder ab dieser Größe werden direkt dorthin gelesen.
+#define PARSER_BUFFER_SIZE (16 * 1024)
+
+typedef enum {
+    PARSE_CONTROL = 0,
+    PARSE_CRUD_HEADER = 1,
+    PARSE_CRUD_KEY = 2,
+    PARSE_CRUD_VALUE = 3,
+    PARSE_CHORD_BODY = 4,
+    PARSE_CRUD_EXTENSION = 5,
+    PARSE_CHORD_EXTENSION = 6,
+    PARSE_CRUD_FIELDS = 7,  // Key und Value am Stück im Slab, ohne sie zu kopieren
+} parser_state;
+
+typedef enum {
+    PARSER_INCOMPLETE = 0,  // Socket hat gerade nichts mehr zu lesen, später weitermachen
+    PARSER_COMPLETE = 1,    // ein komplettes Paket wurde zurückgegeben
+    PARSER_CLOSED = 2,      // Gegenseite hat die Verbindung zwischen zwei Paketen beendet
+    PARSER_ERROR = 3,       // Verbindung abgebrochen mitten im Paket oder ungültiges Paket
+} parser_status;
+
+// Zustand von einem Paket, das noch nicht komplett angekommen ist. Jede Verbindung hat ihren eigenen Parser,
+// damit ein langsamer Client nur sich selbst aufhält und nicht die ganze Event Loop.
+// Gelesen wird nicht Feld für Feld, sondern immer so viel, wie der Socket gerade hat, in einen Slab. Header werden
+// daraus zusammengesetzt, Key und Value bleiben dort liegen, ein kleines Paket kostet so nur noch ein recv() statt
+// vier und keine Kopie von Key und Value.
+typedef struct {
+    parser_state state;
+    uint8_t control;
+    uint8_t scratch[CHORD_PACKET_SIZE];  // Zwischenspeicher für Header, Body und Erweiterungsfelder, alle passen hier rein
+    uint8_t* target;                     // hier landen die Bytes vom aktuellen Zustand
+    uint32_t expected;                   // so viele Bytes braucht der aktuelle Zustand insgesamt
+    uint32_t received;                   // so viele Bytes davon sind schon da
+    generic_packet packet;               // Paket, das gerade zusammengebaut wird
+    shared_block* slab;                  // PARSER_BUFFER_SIZE Bytes vom Socket, von denen buffer_start bis buffer_end noch nicht verbraucht sind
+    uint32_t buffer_start;
+    uint32_t buffer_end;
+    unsigned int drained : 1;  // das letzte recv() hat weniger geliefert als Platz war, der Socket ist also leer
+} packet_parser;
+
+void parser_initialize(packet_parser* p);
+parser_status parser_receive(packet_parser* p, int fd, generic_packet* out);
+void parser_destruct(packet_parser* p);
+
+#endif
\ No newline at end of file
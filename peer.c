@@ -1,24 +1,47 @@
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
+#include <linux/errqueue.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
-#include <poll.h>
 #include "datastore.h"
+#include "reactor.h"
+#include "pool.h"
 #include "VLA.h"
+#include "finger.h"
+#include "hash.h"
+#include "ring.h"
 #include "peer.h"
 #include "debug.h"
 
 // wird von uthash gebraucht, um Hash Table zu erstellen
-client_info *internal_hash_head = NULL;
+pending_operation *operation_hash_head = NULL;
 
 int is_running = 1;
+volatile sig_atomic_t stats_requested = 0;
+volatile sig_atomic_t persist_requested = 0;
+
+reactor *event_loop = NULL;
+peer *nodes = NULL;
+finger_table fingers;
+route_cache routes;
+ring_layout layout;
+pending_operation *fix_finger_operation = NULL;
+// Operationen, die auf das Syncen vom Log warten, in der Reihenfolge ihrer Records
+pending_operation *persist_head = NULL;
+pending_operation *persist_tail = NULL;
+// Freigegebene Slots, die für die nächsten Anfragen wiederverwendet werden, über next verkettet
+response_slot *free_slots = NULL;
+size_t free_slot_count = 0;
 
 // Wird ausgeführt, wenn das Programm ein SIGINT Signal bekommt.
 // Diese Funktion setzt is_running auf false, damit nach dem while-loop Handling gemacht werden kann
@@ -26,9 +49,823 @@ void close_handler(int num) {
     is_running = 0;
 }
 
+// SIGUSR1 schreibt den Speicherverbrauch vom Datastore nach stderr, ohne den Peer anzuhalten
+void stats_handler(int num) {
+    stats_requested = 1;
+}
+
+// SIGUSR2 schreibt den Log im Hintergrund neu, auch wenn er noch nicht groß genug dafür ist,
+// und mit Snapshotdatei auch gleich einen neuen Snapshot
+void persist_handler(int num) {
+    persist_requested = 1;
+}
+
+void destroy_connection(reactor_handler *h) {
+    connection *conn = h->context;
+    parser_destruct(&conn->parser);
+    free(conn);
+}
+
+// Gibt slot zurück an free_slots, ab RESPONSE_SLOT_CACHE_SIZE aufgehobenen Slots wirklich frei
+void release_slot(response_slot *slot) {
+    if (free_slot_count >= RESPONSE_SLOT_CACHE_SIZE) {
+        free(slot);
+        return;
+    }
+    slot->next = free_slots;
+    free_slots = slot;
+    free_slot_count++;
+}
+
+// Merkt sich ein gerade erfolgreiches sendmsg() mit MSG_ZEROCOPY. Der Kernel nummeriert diese Aufrufe pro Socket ab 0 durch.
+void track_zerocopy(connection *conn, shared_bytes *owner) {
+    zerocopy_send *send = malloc(sizeof(zerocopy_send));
+    if (send == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    send->id = conn->zerocopy_next++;
+    send->owner = shared_bytes_retain(owner);
+    send->next = NULL;
+
+    if (conn->zerocopy_tail == NULL) {
+        conn->zerocopy_head = send;
+    } else {
+        conn->zerocopy_tail->next = send;
+    }
+    conn->zerocopy_tail = send;
+}
+
+// Gibt die Values aller sendmsg() mit den Nummern first bis last frei. Die Nummern dürfen dabei überlaufen.
+void release_zerocopy(connection *conn, uint32_t first, uint32_t last) {
+    zerocopy_send **link = &conn->zerocopy_head;
+    conn->zerocopy_tail = NULL;
+    while (*link != NULL) {
+        zerocopy_send *send = *link;
+        if (send->id - first <= last - first) {
+            *link = send->next;
+            shared_bytes_release(send->owner);
+            free(send);
+        } else {
+            conn->zerocopy_tail = send;
+            link = &send->next;
+        }
+    }
+}
+
+// Holt die Meldungen für MSG_ZEROCOPY von der Error Queue vom Socket, epoll meldet sie als EPOLLERR.
+// Musste der Kernel doch kopieren, zB. über Loopback, bringt MSG_ZEROCOPY auf dieser Verbindung nichts und wird abgeschaltet.
+void reap_zerocopy(connection *conn) {
+    while (conn->zerocopy_head != NULL) {
+        union {
+            struct cmsghdr header;
+            uint8_t bytes[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        } control;
+        struct msghdr message = {.msg_control = control.bytes, .msg_controllen = sizeof(control.bytes)};
+        if (recvmsg(conn->handler.fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            int is_error = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!is_error) continue;
+            struct sock_extended_err *error = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0) continue;
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) conn->zerocopy = 0;
+            release_zerocopy(conn, error->ee_info, error->ee_data);
+        }
+    }
+}
+
+// Schließt die Verbindung und verwirft alle Antworten, die noch nicht verschickt wurden.
+// Das struct selbst wird erst nach dem aktuellen Durchlauf der Event Loop freigegeben.
+void close_connection(connection *conn) {
+    if (conn->handler.retired) return;
+
+    // Der Kernel könnte Values, die mit MSG_ZEROCOPY rausgingen, nach dem close() noch einmal senden. Mit einem RST
+    // verwirft er alles, was noch nicht bestätigt ist, danach können sie freigegeben werden. Geordnet geschlossen wird
+    // erst, wenn keine Meldungen mehr ausstehen, siehe flush_responses().
+    if (conn->zerocopy_head != NULL) {
+        struct linger reset = {.l_onoff = 1, .l_linger = 0};
+        setsockopt(conn->handler.fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        release_zerocopy(conn, 0, UINT32_MAX);
+    }
+
+    while (conn->queue_head != NULL) {
+        response_slot *slot = conn->queue_head;
+        conn->queue_head = slot->next;
+        // REPLY oder Antwort vom anderen Peer kommen trotzdem noch an und werden dann einfach verworfen
+        if (slot->operation != NULL) {
+            slot->operation->conn = NULL;
+            slot->operation->slot = NULL;
+        }
+        free_crud_packet(slot->request);
+        if (slot->response != NULL) free_crud_packet(slot->response);
+        release_slot(slot);
+    }
+    conn->queue_tail = NULL;
+
+    reactor_retire(event_loop, &conn->handler);
+    close(conn->handler.fd);
+}
+
+// Kam die Anfrage von einem anderen Peer, trägt sie eine Request ID, die in der Antwort wieder auftauchen muss,
+// damit der Peer sie auf seiner geteilten Verbindung zuordnen kann.
+void address_response(crud_packet *request, crud_packet *response) {
+    response->reserved = (response->reserved & ~CRUD_FLAG_REQUEST_ID) | (request->reserved & CRUD_FLAG_REQUEST_ID);
+    response->request_id = request->request_id;
+}
+
+// Gibt den ausstehenden Fehler vom Socket zurück, 0 wenn es keinen gibt
+int socket_error(int fd) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1) return errno;
+    return error;
+}
+
+// Solange Antworten nicht raus können, wird auch nicht weitergelesen. Sonst könnte ein Client, der selbst nichts
+// liest, beliebig viele Antworten im Speicher vom Peer auflaufen lassen.
+void update_interest(connection *conn) {
+    uint32_t events = conn->write_blocked ? EPOLLOUT : (conn->read_closed ? 0 : EPOLLIN);
+    reactor_modify(event_loop, &conn->handler, events);
+}
+
+// Hängt request hinten an die Warteschlange der Verbindung an. Die Warteschlange besitzt ab jetzt die Anfrage.
+response_slot *enqueue_request(connection *conn, crud_packet *request) {
+    response_slot *slot = free_slots;
+    if (slot != NULL) {
+        free_slots = slot->next;
+        free_slot_count--;
+    } else {
+        slot = malloc(sizeof(response_slot));
+        if (slot == NULL) {
+            panic("%s\n", strerror(errno));
+        }
+    }
+    slot->request = request;
+    slot->response = NULL;
+    slot->operation = NULL;
+    slot->next = NULL;
+
+    if (conn->queue_tail == NULL) {
+        conn->queue_head = slot;
+    } else {
+        conn->queue_tail->next = slot;
+    }
+    conn->queue_tail = slot;
+
+    return slot;
+}
+
+// Große Antworten gehen einzeln raus: steht das Value in einer Datei, mit sendfile(), sonst mit MSG_ZEROCOPY.
+// Beides lohnt sich erst, wenn das Value groß ist, und braucht einen eigenen Syscall.
+int sends_alone(connection *conn, crud_packet *response) {
+    if (response->value_in_file) return 1;
+    return conn->zerocopy && response->value->owner != NULL && response->value->length >= RESPONSE_ZEROCOPY_MIN_SIZE;
+}
+
+// Schickt von response alles ab conn->sent: erst Präfix und Key mit einem normalen sendmsg(), dann das Value ohne
+// Kopie, aus der Datei mit sendfile() oder aus dem Speicher mit MSG_ZEROCOPY. Ohne Kopie darf nur das Value gehen,
+// Präfix und Key sind schon weg, bevor der Kernel mit dem Verschicken fertig ist.
+// In *attempted steht danach, wie viele Bytes der Aufruf schicken wollte.
+ssize_t send_alone(connection *conn, crud_packet *response, uint8_t *prefix, size_t *attempted) {
+    struct iovec iov[CRUD_IOVEC_COUNT];
+    int count = crud_packet_iovec(response, prefix, iov);
+    if (!response->value_in_file) count--;  // nur Präfix und Key
+    size_t head_length = crud_encoded_size(response) - response->value->length;
+
+    if (conn->sent < head_length) {
+        struct iovec *remaining = iov;
+        count = iovec_advance(&remaining, count, conn->sent);
+        *attempted = head_length - conn->sent;
+        // MSG_MORE, damit Präfix und Key nicht als eigenes kleines Segment vor dem Value rausgehen
+        struct msghdr message = {.msg_iov = remaining, .msg_iovlen = count};
+        return sendmsg(conn->handler.fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_MORE);
+    }
+
+    size_t value_sent = conn->sent - head_length;
+    *attempted = response->value->length - value_sent;
+    if (response->value_in_file) {
+        off_t offset = response->value_offset + value_sent;
+        return sendfile(conn->handler.fd, response->value_fd, &offset, *attempted);
+    }
+
+    struct iovec value = {.iov_base = response->value->contents + value_sent, .iov_len = *attempted};
+    struct msghdr message = {.msg_iov = &value, .msg_iovlen = 1};
+    ssize_t bytes_sent = sendmsg(conn->handler.fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ZEROCOPY);
+    if (bytes_sent >= 0) track_zerocopy(conn, response->value->owner);
+    // Ohne Platz für die Meldungen geht es auch ohne MSG_ZEROCOPY
+    if (bytes_sent < 0 && errno == ENOBUFS) bytes_sent = sendmsg(conn->handler.fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return bytes_sent;
+}
+
+// Verschickt alle fertigen Antworten vom Anfang der Warteschlange. Eine Antwort, die noch aussteht, hält alle
+// dahinter auf, damit der Client sie in der gleichen Reihenfolge bekommt, in der er gefragt hat.
+// Bis zu RESPONSE_BATCH_SIZE Antworten gehen zusammen mit einem sendmsg() raus, Keys und Values werden dafür nicht
+// kopiert. Nur große Values gehen einzeln raus, siehe sends_alone(). Ist der Socket voll, bleibt der Rest in der
+// Warteschlange, conn->sent merkt sich, wie viel von der ersten Antwort schon draußen ist, und es geht weiter,
+// sobald epoll EPOLLOUT meldet.
+// Hat der Client schon fertig geschrieben und ist nichts mehr offen, wird die Verbindung geschlossen. Wartet der
+// Kernel noch auf Values, die mit MSG_ZEROCOPY rausgingen, passiert das erst, wenn reap_zerocopy() alle freigegeben hat.
+void flush_responses(connection *conn) {
+    uint8_t prefixes[RESPONSE_BATCH_SIZE][CRUD_MAX_PREFIX_SIZE];
+    struct iovec iov[RESPONSE_BATCH_SIZE * CRUD_IOVEC_COUNT];
+    size_t lengths[RESPONSE_BATCH_SIZE];
+    int blocked = 0;
+
+    while (conn->queue_head != NULL && conn->queue_head->response != NULL && !blocked) {
+        crud_packet *first = conn->queue_head->response;
+        address_response(conn->queue_head->request, first);
+        lengths[0] = crud_encoded_size(first);
+        int completed;
+
+        if (sends_alone(conn, first)) {
+            size_t attempted = 0;
+            ssize_t bytes_sent = send_alone(conn, first, prefixes[0], &attempted);
+            if (bytes_sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                warn("%s\n", strerror(errno));
+                close_connection(conn);
+                return;
+            }
+            // sendfile() schickt nichts mehr, wenn die Datei kürzer ist als das Value
+            if (bytes_sent == 0 && attempted > 0) {
+                warn("Value file ended before the value on socket %d was sent.\n", conn->handler.fd);
+                close_connection(conn);
+                return;
+            }
+            blocked = (size_t)bytes_sent < attempted;
+            completed = iovec_messages_done(&conn->sent, bytes_sent, lengths, 1);
+        } else {
+            int batched = 1;
+            int count = crud_packet_iovec(first, prefixes[0], iov);
+            for (response_slot *slot = conn->queue_head->next; slot != NULL && slot->response != NULL && batched < RESPONSE_BATCH_SIZE; slot = slot->next) {
+                if (sends_alone(conn, slot->response)) break;
+                address_response(slot->request, slot->response);
+                lengths[batched] = crud_encoded_size(slot->response);
+                count += crud_packet_iovec(slot->response, prefixes[batched++], iov + count);
+            }
+
+            completed = send_iovec_messages(conn->handler.fd, iov, count, lengths, batched, &conn->sent, &blocked);
+            if (completed < 0) {
+                warn("%s\n", strerror(errno));
+                close_connection(conn);
+                return;
+            }
+        }
+
+        // Alle Antworten, die jetzt komplett draußen sind, werden freigegeben
+        for (; completed > 0; completed--) {
+            response_slot *slot = conn->queue_head;
+            conn->queue_head = slot->next;
+            if (conn->queue_head == NULL) conn->queue_tail = NULL;
+            free_crud_packet(slot->request);
+            free_crud_packet(slot->response);
+            release_slot(slot);
+        }
+    }
+
+    conn->write_blocked = conn->queue_head != NULL && conn->queue_head->response != NULL;
+    update_interest(conn);
+
+    if (conn->read_closed && conn->queue_head == NULL && conn->zerocopy_head == NULL) {
+        shutdown(conn->handler.fd, SHUT_WR);
+        close_connection(conn);
+    }
+}
+
+// Ist der Socket gerade voll, geht die Antwort mit den anderen raus, sobald epoll EPOLLOUT meldet.
+// Während handle_connection_event() noch Anfragen liest, wird sie erst danach mit allen anderen zusammen verschickt.
+void complete_request(connection *conn, response_slot *slot, crud_packet *response) {
+    slot->response = response;
+    if (!conn->write_blocked && !conn->deferring) flush_responses(conn);
+}
+
+crud_packet *get_failure_response(crud_packet *request) {
+    crud_packet *response = get_blank_crud_packet();
+    response->action = request->action;
+    return response;
+}
+
+// Legt eine neue Operation für die Anfrage in slot an. Die Request ID ist pro Peer eindeutig, und weil REPLYs immer
+// an den Peer gehen, der den Lookup gestartet hat, reicht das, um jede Antwort der richtigen Anfrage zuzuordnen.
+pending_operation *start_operation(connection *conn, response_slot *slot, operation_state state) {
+    static uint32_t next_request_id = 0;
+
+    pending_operation *op = malloc(sizeof(pending_operation));
+    if (op == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    op->request_id = next_request_id++;
+    op->state = state;
+    op->conn = conn;
+    op->slot = slot;
+    op->via = NULL;
+    op->ip4 = 0;
+    op->port = 0;
+    op->attempts = 0;
+    op->lookups = 0;
+    op->finger_index = -1;
+    op->log_position = 0;
+    op->response = NULL;
+    op->next = NULL;
+    if (slot != NULL) slot->operation = op;
+    HASH_ADD(hh, operation_hash_head, request_id, sizeof(op->request_id), op);
+
+    return op;
+}
+
+// Beendet op mit response. Ist der Client inzwischen weg, wird die Antwort nur noch freigegeben.
+void finish_operation(pending_operation *op, crud_packet *response) {
+    HASH_DEL(operation_hash_head, op);
+    if (op == fix_finger_operation) fix_finger_operation = NULL;
+
+    if (op->conn != NULL) {
+        op->slot->operation = NULL;
+        complete_request(op->conn, op->slot, response);
+    } else if (response != NULL) {
+        free_crud_packet(response);
+    }
+    free(op);
+}
+
+// Schickt die Anfrage von op über die Pool-Verbindung zu op->ip4:op->port. Die Anfrage geht dafür mit der Request ID
+// von op raus, die Request ID vom ursprünglichen Absender bleibt in der Anfrage stehen.
+// Wenn das Senden oder der Verbindungsaufbau fehlschlägt, kümmert sich handle_pool_failure() über pool_invalidate()
+// um op. Kommt gar keine Verbindung zustande, bekommt der Client sofort eine Antwort ohne ACK-Bit.
+// op kann danach also schon beendet sein.
+void send_forward(pending_operation *op) {
+    op->attempts++;
+    op->via = pool_get_connection(op->ip4, op->port);
+    if (op->via == NULL) {
+        warn("Couldn't forward request to another peer.\n");
+        finish_operation(op, op->conn != NULL ? get_failure_response(op->slot->request) : NULL);
+        return;
+    }
+    pool_send_crud_packet(op->via, op->slot->request, op->request_id);
+}
+
+// Leitet op an ip4:port weiter, ohne auf die Antwort zu warten.
+// Sobald sie ankommt, wird sie in handle_pool_packet() in den Slot eingetragen und an den Client geschickt.
+void forward_operation(pending_operation *op, uint32_t ip4, uint16_t port) {
+    op->state = OP_FORWARD;
+    op->ip4 = ip4;
+    op->port = port;
+    send_forward(op);
+}
+
+// Schickt einen LOOKUP für hash_value mit der Request ID von op los. Er geht an den Finger, der am nächsten
+// vor hash_value liegt, und nicht mehr nur an den Nachfolger.
+// Geht die Verbindung zum Finger kaputt, bevor die Antwort da ist, wird op in handle_pool_failure() aufgegeben.
+void send_lookup(pending_operation *op, uint16_t hash_value) {
+    chord_packet *pkg = get_blank_chord_packet();
+
+    pkg->action = LOOKUP;
+    pkg->reserved = CHORD_FLAG_REQUEST_ID;
+    pkg->request_id = op->request_id;
+    pkg->hash_id = hash_value;
+    pkg->node_id = nodes[0].node_id;
+    pkg->node_ip = nodes[0].node_ip;
+    pkg->node_port = nodes[0].node_port;
+
+    peer *next = finger_closest_preceding(&fingers, hash_value);
+    op->via = pool_get_connection(next->node_ip, next->node_port);
+    if (op->via == NULL) {
+        warn("Couldn't send lookup to another peer.\n");
+        finish_operation(op, op->conn != NULL ? get_failure_response(op->slot->request) : NULL);
+    } else {
+        pool_send_chord_packet(op->via, pkg);
+    }
+    free(pkg);
+}
+
+// Wird alle FIX_FINGERS_INTERVAL Millisekunden aufgerufen und schlägt einen Finger neu nach.
+// Ist der Besitzer vom Startwert schon aus der Aufteilung vom Ring bekannt, braucht es dafür keinen Lookup.
+void fix_fingers(void *context) {
+    int index = finger_next_to_fix(&fingers);
+    uint16_t start = fingers.entries[index].start;
+
+    peer *owner = ring_find_owner(&layout, start, NULL, NULL);
+    if (owner != NULL) {
+        finger_update(&fingers, index, owner->node_id, owner->node_ip, owner->node_port);
+        return;
+    }
+
+    // Es ist immer nur ein Lookup für die Finger Table unterwegs. Kam auf den letzten keine Antwort, wird er aufgegeben.
+    if (fix_finger_operation != NULL) finish_operation(fix_finger_operation, NULL);
+
+    fix_finger_operation = start_operation(NULL, NULL, OP_FIX_FINGER);
+    fix_finger_operation->finger_index = index;
+    send_lookup(fix_finger_operation, start);
+}
+
+// Hält die Antwort in slot zurück, bis der Log bis log_position gesynct ist. Die Event Loop läuft so lange weiter,
+// und alle Änderungen, die bis zum nächsten fdatasync() dazukommen, werden vom gleichen Sync mit bestätigt.
+void wait_for_log(connection *conn, response_slot *slot, crud_packet *response, uint64_t log_position) {
+    pending_operation *op = start_operation(conn, slot, OP_PERSIST);
+    op->log_position = log_position;
+    op->response = response;
+
+    if (persist_tail == NULL) {
+        persist_head = op;
+    } else {
+        persist_tail->next = op;
+    }
+    persist_tail = op;
+}
+
+// Der I/O Thread vom Log hat wieder etwas gesynct. Alle Antworten, deren Records jetzt sicher sind, dürfen raus.
+void handle_log_event(reactor_handler *h, uint32_t events) {
+    uint64_t commits;
+    if (read(h->fd, &commits, sizeof(commits)) == -1 && errno != EAGAIN) {
+        warn("%s\n", strerror(errno));
+    }
+
+    uint64_t durable = ds_log_durable();
+    while (persist_head != NULL && persist_head->log_position <= durable) {
+        pending_operation *op = persist_head;
+        persist_head = op->next;
+        if (persist_head == NULL) persist_tail = NULL;
+        finish_operation(op, op->response);
+    }
+}
+
+// Position vom Key im Ring. Früher waren das einfach die ersten zwei Bytes vom Key, dann sind aber alle Keys
+// mit gleichem Präfix (zB. "user:...") beim gleichen Peer gelandet.
+uint16_t get_hash_value(crud_packet *request) {
+    return hash_key_to_ring(request->key->contents, request->key->length);
+}
+
+void handle_crud_request(connection *conn, crud_packet *client_request) {
+    response_slot *slot = enqueue_request(conn, client_request);
+    uint16_t hash_value = get_hash_value(client_request);
+    peer *owner = ring_find_owner(&layout, hash_value, NULL, NULL);
+    peer *cached = NULL;
+
+    if (owner == layout.self) {
+        debug("I am responsible for the hash value, now sending back answer to Client.\n");
+        // Führe die Request vom Client aus und sende ihm zurück, ob das auch geklappt hat.
+        uint64_t log_position = 0;
+        crud_packet *response = execute_ds_action(client_request, &log_position);
+        // Bei GET zeigt die Antwort direkt auf das Value im Datastore und hält es fest, auch wenn sie noch hinter
+        // einer anderen Antwort warten muss und das Value bis dahin überschrieben oder gelöscht wird.
+        if (log_position != 0) {
+            wait_for_log(conn, slot, response, log_position);
+        } else {
+            complete_request(conn, slot, response);
+        }
+    } else if (client_request->reserved & CRUD_FLAG_REQUEST_ID) {
+        // Nur Peers schicken Request IDs mit, und die leiten nur an den zuständigen Peer weiter. Kommt die Anfrage
+        // trotzdem hier an, hatte der Absender einen veralteten Eintrag im Route Cache und soll selbst neu nachschlagen.
+        debug("Got a forwarded request for hash value %#x, but I am not responsible for it.\n", hash_value);
+        crud_packet *rejection = get_failure_response(client_request);
+        rejection->reserved = CRUD_FLAG_NOT_RESPONSIBLE;
+        complete_request(conn, slot, rejection);
+    } else if (owner != NULL) {  // Nachfolger oder laut Mitgliederdatei ein anderer Peer ist für den Bereich zuständig, einfach Request an ihn weiterleiten
+        debug("Node %#x is responsible for the hash value, now sending back answer to Client over one redirection.\n", owner->node_id);
+        forward_operation(start_operation(conn, slot, OP_FORWARD), owner->node_ip, owner->node_port);
+    } else if ((cached = route_cache_find(&routes, hash_value)) != NULL) {  // Bereich wurde schon einmal nachgeschlagen
+        debug("Route cache says node %#x is responsible for hash value %#x, skipping the lookup.\n", cached->node_id, hash_value);
+        forward_operation(start_operation(conn, slot, OP_FORWARD), cached->node_ip, cached->node_port);
+    } else {  // es ist noch nicht bekannt, wer für den Bereich verantwortlich ist -> lookup machen
+        pending_operation *op = start_operation(conn, slot, OP_LOOKUP);
+        debug("Don't know who is responsible for hash value %#x, starting lookup with request ID %u!\n", hash_value, op->request_id);
+        send_lookup(op, hash_value);
+    }
+}
+
+void handle_chord_message(connection *conn, chord_packet *ring_message) {
+    if (ring_message->action == REPLY) {
+        debug("Got a reply, now I know who is responsible for the hash value. Trying to send answer to Client over one redirection.\n");
+        pending_operation *op = NULL;
+        HASH_FIND(hh, operation_hash_head, &ring_message->request_id, sizeof(ring_message->request_id), op);
+        if (!(ring_message->reserved & CHORD_FLAG_REQUEST_ID) || op == NULL || (op->state != OP_LOOKUP && op->state != OP_FIX_FINGER)) {
+            warn("No lookup with request ID %u for Key %#x is pending. Something went wrong inside the ring.\n", ring_message->request_id, ring_message->hash_id);
+            return;
+        }
+
+        // Der Bereich gilt auch für alle anderen Keys darin, die brauchen dann keinen eigenen Lookup mehr
+        if (ring_message->reserved & CHORD_FLAG_RANGE) {
+            route_cache_insert(&routes, ring_message->area_start, ring_message->area_stop, ring_message->node_id, ring_message->node_ip, ring_message->node_port);
+        }
+
+        if (op->state == OP_FIX_FINGER) {
+            finger_update(&fingers, op->finger_index, ring_message->node_id, ring_message->node_ip, ring_message->node_port);
+            finish_operation(op, NULL);
+            return;
+        }
+
+        if (op->conn == NULL) {
+            debug("Client of lookup %u is gone, dropping the reply.\n", op->request_id);
+            finish_operation(op, NULL);
+            return;
+        }
+
+        forward_operation(op, ring_message->node_ip, ring_message->node_port);
+    } else if (ring_message->action == LOOKUP) {
+        uint16_t area_start, area_stop;
+        peer *responsible = ring_find_owner(&layout, ring_message->hash_id, &area_start, &area_stop);
+
+        if (responsible != NULL) {
+            debug("Got a lookup request and know who is responsible for the hash value. Sending back answer to the origin of the lookup.\n");
+            chord_packet *reply = get_blank_chord_packet();
+
+            reply->action = REPLY;
+            reply->reserved = (ring_message->reserved & CHORD_FLAG_REQUEST_ID) | CHORD_FLAG_RANGE;
+            reply->request_id = ring_message->request_id;
+            reply->area_start = area_start;
+            reply->area_stop = area_stop;
+            reply->hash_id = ring_message->hash_id;
+            reply->node_id = responsible->node_id;
+            reply->node_ip = responsible->node_ip;
+            reply->node_port = responsible->node_port;
+
+            pooled_connection *pc = pool_get_connection(ring_message->node_ip, ring_message->node_port);
+            if (pc != NULL) pool_send_chord_packet(pc, reply);
+            free(reply);
+        } else {
+            debug("Got a lookup request, but I also don't know who is responsible for the hash value. Forwarding lookup to the closest preceding finger.\n");
+            peer *next = finger_closest_preceding(&fingers, ring_message->hash_id);
+            pooled_connection *pc = pool_get_connection(next->node_ip, next->node_port);
+            if (pc != NULL) pool_send_chord_packet(pc, ring_message);
+        }
+    }
+}
+
+// Wird für jedes Paket aufgerufen, das auf einer Pool-Verbindung ankommt. Das sind Antworten auf weitergeleitete Anfragen.
+void handle_pool_packet(pooled_connection *pc, generic_packet *pkg) {
+    if (pkg->type == PROTO_CHORD) {
+        handle_chord_message(NULL, (chord_packet *)pkg->contents);
+        free(pkg->contents);
+        return;
+    }
+
+    crud_packet *response = pkg->contents;
+
+    pending_operation *op = NULL;
+    HASH_FIND(hh, operation_hash_head, &response->request_id, sizeof(response->request_id), op);
+    if (op == NULL || op->state != OP_FORWARD) {
+        warn("Got a response with unknown request ID %u on pooled connection (fd=%d).\n", response->request_id, pc->handler.fd);
+        free_crud_packet(response);
+        return;
+    }
+
+    if (response->reserved & CRUD_FLAG_NOT_RESPONSIBLE) {
+        free_crud_packet(response);
+        route_cache_invalidate(&routes, op->ip4, op->port);
+
+        if (op->conn != NULL && op->lookups < FORWARD_ATTEMPTS) {
+            debug("Peer rejected forwarded request %u, looking up the responsible peer again.\n", op->request_id);
+            op->state = OP_LOOKUP;
+            op->attempts = 0;
+            op->lookups++;
+            send_lookup(op, get_hash_value(op->slot->request));
+        } else {
+            warn("Peer rejected forwarded request %u.\n", op->request_id);
+            finish_operation(op, op->conn != NULL ? get_failure_response(op->slot->request) : NULL);
+        }
+        return;
+    }
+
+    finish_operation(op, response);
+}
+
+// Die Verbindung pc ist kaputt gegangen oder kam gar nicht erst zustande. Alle Anfragen, die darüber noch unterwegs waren,
+// werden über eine neue Verbindung noch einmal geschickt, oder bekommen nach FORWARD_ATTEMPTS Versuchen eine Antwort
+// ohne ACK-Bit. Lookups, die darüber liefen, werden gleich aufgegeben.
+// Die betroffenen Anfragen werden erst gesammelt, weil send_forward() beim nächsten Fehler wieder hier landen kann.
+void handle_pool_failure(pooled_connection *pc) {
+    // Der Peer ist abgestürzt oder neu gestartet, vielleicht mit anderem Bereich. Im Zweifel lieber neu nachschlagen.
+    route_cache_invalidate(&routes, pc->ip4, pc->port);
+
+    VLA *affected = VLA_initialize(8, sizeof(pending_operation *));
+    pending_operation *current, *tmp;
+
+    HASH_ITER(hh, operation_hash_head, current, tmp) {
+        if (current->via == pc) VLA_insert(affected, &current, 1);
+    }
+
+    pending_operation **ops = (pending_operation **)affected->memory->contents;
+    for (size_t i = 0; i < affected->memory->length / affected->item_size; i++) {
+        pending_operation *op = ops[i];
+        if (op->state != OP_FORWARD) {
+            warn("Couldn't send lookup to another peer.\n");
+            finish_operation(op, op->conn != NULL ? get_failure_response(op->slot->request) : NULL);
+        } else if (op->conn != NULL && op->attempts < FORWARD_ATTEMPTS) {
+            debug("Retrying forwarded request %u over a new connection.\n", op->request_id);
+            send_forward(op);
+        } else {
+            warn("Couldn't forward request to another peer.\n");
+            finish_operation(op, op->conn != NULL ? get_failure_response(op->slot->request) : NULL);
+        }
+    }
+
+    VLA_cleanup(affected, NULL);
+}
+
+// Liest alle Pakete, die gerade auf der Verbindung anliegen. Der Parser der Verbindung baut sie nach und nach zusammen,
+// ohne dass die Event Loop auf fehlende Bytes wartet. Clients und andere Peers können beliebig viele Anfragen
+// hintereinander auf einer Verbindung schicken. Wenn die Gegenseite fertig geschrieben hat, wird nur noch gewartet,
+// bis alle offenen Antworten verschickt wurden, und dann geschlossen.
+void handle_connection_event(reactor_handler *h, uint32_t events) {
+    connection *conn = h->context;
+
+    // EPOLLERR kommt auch, wenn nur Meldungen für MSG_ZEROCOPY auf der Error Queue liegen. Zugemacht wird nur,
+    // wenn der Socket selbst einen Fehler hat.
+    if (events & EPOLLERR) reap_zerocopy(conn);
+    if ((events & EPOLLHUP) || ((events & EPOLLERR) && socket_error(h->fd) != 0)) {
+        close_connection(conn);
+        return;
+    }
+
+    // Der Socket hat wieder Platz für Antworten, die vorher nicht rausgingen. Danach wird auch weitergelesen,
+    // im Parser können noch komplette Anfragen liegen, für die epoll nicht noch einmal Bescheid gibt.
+    if (events & EPOLLOUT) {
+        flush_responses(conn);
+        if (h->retired || conn->write_blocked) return;
+    }
+
+    // Der Lesekanal ist schon zu, es kann nur noch verschickt oder auf den Kernel gewartet werden
+    if (conn->read_closed) {
+        if (!(events & EPOLLOUT)) flush_responses(conn);
+        return;
+    }
+
+    // Antworten auf alles, was in einem Rutsch ankommt, werden erst am Ende zusammen verschickt
+    conn->deferring = 1;
+    int handled = 0;
+    parser_status status = PARSER_INCOMPLETE;
+    while (!h->retired && !conn->write_blocked) {
+        generic_packet request;
+        status = parser_receive(&conn->parser, h->fd, &request);
+        if (status != PARSER_COMPLETE) break;
+
+        if (request.type == PROTO_CRUD) {
+            handle_crud_request(conn, (crud_packet *)request.contents);
+        } else if (request.type == PROTO_CHORD) {
+            handle_chord_message(conn, (chord_packet *)request.contents);
+            free(request.contents);
+        }
+
+        // Ein Client, der ohne Pause schickt, soll trotzdem regelmäßig Antworten bekommen
+        if (++handled == RESPONSE_BATCH_SIZE) {
+            handled = 0;
+            conn->deferring = 0;
+            flush_responses(conn);
+            conn->deferring = 1;
+        }
+    }
+    conn->deferring = 0;
+    if (h->retired) return;
+
+    if (status == PARSER_ERROR) {
+        close_connection(conn);
+        return;
+    }
+    // Level-triggered epoll würde bei EOF sonst ständig wieder aufwachen
+    if (status == PARSER_CLOSED) conn->read_closed = 1;
+    flush_responses(conn);
+}
+
+void handle_listener_event(reactor_handler *h, uint32_t events) {
+    struct sockaddr_storage their_address;
+    socklen_t addr_size = sizeof their_address;
+
+    debug("Got new connection on listener socket (fd=%d)\n", h->fd);
+    int connect_fd = accept(h->fd, (struct sockaddr *)&their_address, &addr_size);
+    if (connect_fd == -1) {
+        if (errno != EINTR) warn("%s\n", strerror(errno));
+        return;
+    }
+
+    // Antworten gehen raus, sobald sie fertig sind, oft einzeln. Auf einer Verbindung, die für viele Anfragen offen bleibt,
+    // würde Nagle zusammen mit Delayed ACKs sonst jede Antwort um einige Millisekunden verzögern.
+    if (setsockopt(connect_fd, IPPROTO_TCP, TCP_NODELAY, (int[]){1}, sizeof(int)) == -1) {
+        warn("%s\n", strerror(errno));
+    }
+    // sendfile() kennt kein MSG_DONTWAIT, der Socket selbst darf also nicht blockieren
+    if (fcntl(connect_fd, F_SETFL, fcntl(connect_fd, F_GETFL) | O_NONBLOCK) == -1) {
+        warn("%s\n", strerror(errno));
+    }
+    // Ohne SO_ZEROCOPY würde der Kernel MSG_ZEROCOPY einfach ignorieren, große Values werden dann ganz normal kopiert
+    int zerocopy = setsockopt(connect_fd, SOL_SOCKET, SO_ZEROCOPY, (int[]){1}, sizeof(int)) == 0;
+
+    connection *conn = malloc(sizeof(connection));
+    if (conn == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    reactor_handler_init(&conn->handler, connect_fd, handle_connection_event, destroy_connection, conn);
+    parser_initialize(&conn->parser);
+    conn->queue_head = NULL;
+    conn->queue_tail = NULL;
+    conn->read_closed = 0;
+    conn->write_blocked = 0;
+    conn->deferring = 0;
+    conn->sent = 0;
+    conn->zerocopy_head = NULL;
+    conn->zerocopy_tail = NULL;
+    conn->zerocopy_next = 0;
+    conn->zerocopy = zerocopy;
+    if (reactor_register(event_loop, &conn->handler, EPOLLIN) == -1) {
+        close(connect_fd);
+        free(conn);
+    }
+}
+
+// Liest eine Größe wie "512K" oder "2G" in Bytes. Gibt -1 zurück, wenn der String keine Größe ist.
+int parse_memory_size(char *string, size_t *bytes) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(string, &end, 10);
+    if (errno != 0 || end == string || string[0] == '-') return -1;
+
+    switch (*end) {
+        case 'G': value <<= 10;
+        // fall through
+        case 'M': value <<= 10;
+        // fall through
+        case 'K': value <<= 10;
+            end++;
+            break;
+        case '\0':
+            break;
+        default:
+            return -1;
+    }
+    if (*end != '\0') return -1;
+
+    *bytes = value;
+    return 0;
+}
+
+// Liest die fsync Policy für den Log: "always", "never" oder ein Intervall in Millisekunden
+int parse_fsync_policy(char *string, ds_config *config) {
+    if (strcmp(string, "always") == 0) {
+        config->fsync_policy = LOG_FSYNC_ALWAYS;
+    } else if (strcmp(string, "never") == 0) {
+        config->fsync_policy = LOG_FSYNC_NEVER;
+    } else {
+        char *end;
+        long interval = strtol(string, &end, 10);
+        if (end == string || *end != '\0' || interval <= 0 || interval > INT32_MAX) return -1;
+        config->fsync_policy = LOG_FSYNC_INTERVAL;
+        config->fsync_interval = interval;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 10) {
-        fprintf(stderr, "Benutzung: %s <ID self> <Host self> <Port self>\n\t<ID prev> <Host prev> <Port prev>\n\t<ID next> <Host next> <Port next>\n", argv[0]);
+    char *program = argv[0];
+    char *member_file = NULL;
+    ds_config store_config = {.memory_limit = 0, .admission = 0, .log_path = NULL, .fsync_policy = LOG_FSYNC_INTERVAL, .fsync_interval = DEFAULT_FSYNC_INTERVAL, .snapshot_path = NULL, .snapshot_interval = 0, .value_path = NULL, .spill_threshold = DS_DEFAULT_SPILL_THRESHOLD};
+    int bad_option = 0;
+    int option;
+    while ((option = getopt(argc, argv, "m:M:al:f:s:S:v:t:")) != -1) {
+        if (option == 'm') {
+            member_file = optarg;
+        } else if (option == 'M') {
+            if (parse_memory_size(optarg, &store_config.memory_limit) == -1) {
+                warn("%s is not a memory size.\n", optarg);
+                bad_option = 1;
+            }
+        } else if (option == 'a') {
+            store_config.admission = 1;
+        } else if (option == 'l') {
+            store_config.log_path = optarg;
+        } else if (option == 's') {
+            store_config.snapshot_path = optarg;
+        } else if (option == 'S') {
+            char *end;
+            long interval = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || interval <= 0 || interval > MAX_SNAPSHOT_INTERVAL) {
+                warn("%s is not a snapshot interval.\n", optarg);
+                bad_option = 1;
+            }
+            store_config.snapshot_interval = interval;
+        } else if (option == 'v') {
+            store_config.value_path = optarg;
+        } else if (option == 't') {
+            if (parse_memory_size(optarg, &store_config.spill_threshold) == -1) {
+                warn("%s is not a memory size.\n", optarg);
+                bad_option = 1;
+            }
+        } else if (option == 'f') {
+            if (parse_fsync_policy(optarg, &store_config) == -1) {
+                warn("%s is not an fsync policy.\n", optarg);
+                bad_option = 1;
+            }
+        } else {
+            bad_option = 1;
+        }
+    }
+
+    // Die Positionsargumente werden ab hier so behandelt, als gäbe es keine Optionen davor
+    argv += optind - 1;
+    argc -= optind - 1;
+    if (bad_option || argc != 10) {
+        fprintf(stderr, "Benutzung: %s [-m <Mitgliederdatei>] [-M <Bytes>[K|M|G]] [-a] [-l <Logdatei> [-f always|never|<ms>]] [-s <Snapshotdatei> [-S <Sekunden>]] [-v <Valuedatei> [-t <Bytes>[K|M|G]]] <ID self> <Host self> <Port self>\n\t<ID prev> <Host prev> <Port prev>\n\t<ID next> <Host next> <Port next>\n", program);
         exit(EXIT_FAILURE);
     }
 
@@ -41,7 +878,19 @@ int main(int argc, char *argv[]) {
     strncpy(dbg_identifier + 5, argv[1], id_length);
     dbg_identifier[5 + id_length] = '\0';
 
-    peer *nodes = setup_ring_neighbours(argv);
+    nodes = setup_ring_neighbours(argv);
+    if (nodes == NULL) {
+        panic("Couldn't resolve ring neighbours.\n");
+    }
+
+    // Mit Mitgliederdatei kennt jeder Peer alle virtuellen Knoten und damit den Besitzer von jedem Key.
+    // Vorgänger und Nachfolger werden dann nur noch für Lookups gebraucht, falls doch einer nötig wird.
+    if (member_file != NULL) {
+        ring_layout_from_file(&layout, member_file, nodes[0].node_id);
+    } else {
+        ring_layout_from_neighbours(&layout, nodes);
+    }
+    debug("Responsible for %u of 65536 hash values across %zu ring positions.\n", ring_owned_share(&layout), layout.vnode_count);
     int listener_fd = setup_tcp_listener(argv[3]);
     if (listener_fd == -1) {
         panic("Konnte keine Verbindungssocket erstellen.\n");
@@ -53,156 +902,57 @@ int main(int argc, char *argv[]) {
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGHUP, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = stats_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = persist_handler;
+    sigaction(SIGUSR2, &sa, NULL);
+    // sendfile() hat kein MSG_NOSIGNAL, ein Client, der mittendrin zumacht, darf den Peer nicht beenden
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
 
-    VLA *pfds_VLA = VLA_initialize(5, sizeof(struct pollfd));
-
-    // add listener socket to pfds_VLA set
-    struct pollfd listener_socket = {
-        .fd = listener_fd,
-        .events = POLLIN,
-    };
-    VLA_insert(pfds_VLA, &listener_socket, 1);
+    ds_initialize(&store_config);
+    event_loop = reactor_initialize();
+    pool_initialize(event_loop, handle_pool_packet, handle_pool_failure);
+    finger_table_initialize(&fingers, &nodes[0], &nodes[2]);
+    route_cache_initialize(&routes);
+    reactor_timer *fix_fingers_timer = reactor_start_timer(event_loop, FIX_FINGERS_INTERVAL, fix_fingers, NULL);
+    reactor_timer *maintenance_timer = reactor_start_timer(event_loop, DS_MAINTENANCE_INTERVAL, ds_maintenance, NULL);
 
-    while (is_running) {
-        struct sockaddr_storage their_address;
-        socklen_t addr_size = sizeof their_address;
-        int poll_count = poll((struct pollfd *)pfds_VLA->memory->contents, pfds_VLA->memory->length / pfds_VLA->item_size, -1);
+    // Listener Socket ins epoll-Set aufnehmen
+    reactor_handler listener;
+    reactor_handler_init(&listener, listener_fd, handle_listener_event, NULL, NULL);
+    if (reactor_register(event_loop, &listener, EPOLLIN) == -1) {
+        panic("Couldn't watch listener socket.\n");
+    }
 
-        if (poll_count == -1) {
-            panic("%s\n", strerror(errno));
+    reactor_handler log_events;
+    if (ds_log_notify_fd() != -1) {
+        reactor_handler_init(&log_events, ds_log_notify_fd(), handle_log_event, NULL, NULL);
+        if (reactor_register(event_loop, &log_events, EPOLLIN) == -1) {
+            panic("Couldn't watch log events.\n");
         }
+    }
 
-        for (int i = 0; i < pfds_VLA->memory->length / pfds_VLA->item_size; i++) {
-            struct pollfd pfds_item = *VLA_get_pollfd(pfds_VLA, i);
-            if (pfds_item.revents & POLLIN) {
-                // data is ready to recv() on this socket
-                if (pfds_item.fd == listener_fd) {
-                    // socket is main socket
-                    debug("Got new connection on listener socket (fd=%d)\n", listener_fd);
-                    int connect_fd = accept(listener_fd, (struct sockaddr *)&their_address, &addr_size);
-                    if (connect_fd == -1) {
-                        if (errno != EINTR) warn("%s\n", strerror(errno));
-                        continue;
-                    }
-                    struct pollfd new_connection = {
-                        .fd = connect_fd,
-                        .events = POLLIN,
-                    };
-                    VLA_insert(pfds_VLA, &new_connection, 1);
-                } else {
-                    // socket is not main socket
-                    generic_packet *request = read_unknown_packet(pfds_item.fd);
-                    shutdown(pfds_item.fd, SHUT_RD);
-
-                    if (request->type == PROTO_CRUD) {
-                        crud_packet *client_request = (crud_packet *)request->contents;
-                        uint16_t hash_value = 0;
-                        memcpy(&hash_value, client_request->key->contents, sizeof(uint16_t) > client_request->key->length ? client_request->key->length : sizeof(uint16_t));
-                        hash_value = ntohs(hash_value);
-                        client_info *new = malloc(sizeof(client_info));
-                        if (new == NULL) {
-                            panic("%s\n", strerror(errno));
-                        }
-                        new->key = hash_value;
-                        new->fd = pfds_item.fd;
-                        new->request = client_request;
-                        debug("Storing client information with Key %#x, fd %d and request %p in internal Hash Table.\n", new->key, new->fd, new->request);
-                        HASH_ADD_KEYPTR(hh, internal_hash_head, &new->key, sizeof(new->key), new);
-
-                        if (peer_stores_hashvalue(&nodes[0], hash_value)) {
-                            debug("I am responsible for the hash value, now sending back answer to Client.\n");
-                            // Führe die Request vom Client aus und sende ihm zurück, ob das auch geklappt hat.
-                            crud_packet *response = execute_ds_action(client_request);
-
-                            send_crud_packet(pfds_item.fd, response);
-                            shutdown(pfds_item.fd, SHUT_WR);
-                            close(pfds_item.fd);
-
-                            free_crud_packet(client_request);
-                            free_crud_packet(response);
-                            VLA_delete_by_index(pfds_VLA, i);
-                        } else if (peer_stores_hashvalue(&nodes[2], hash_value)) {  // Nachfolger ist für den Bereich zuständig, einfach Request an ihn weiterleiten
-                            debug("Successor is responsible for the hash value, now sending back answer to Client over one redirection.\n");
-                            int peer_fd = establish_tcp_connection_from_ip4(nodes[2].node_ip, nodes[2].node_port);
-                            send_crud_packet(peer_fd, client_request);
-                            crud_packet *response = get_blank_crud_packet();
-                            receive_crud_packet(peer_fd, response, READ_CONTROL);
-                            send_crud_packet(pfds_item.fd, response);
-                            close(pfds_item.fd);
-                            free_crud_packet(client_request);
-                            free_crud_packet(response);
-                            VLA_delete_by_index(pfds_VLA, i);
-                        } else {  // es ist noch nicht bekannt, wer für den Bereich verantwortlich ist -> lookup machen
-                            debug("Don't know who is responsible for the hash value, starting lookup!\n");
-                            chord_packet *pkg = get_blank_chord_packet();
-
-                            pkg->action = LOOKUP;
-                            pkg->hash_id = hash_value;
-                            pkg->node_id = nodes[0].node_id;
-                            pkg->node_ip = nodes[0].node_ip;
-                            pkg->node_port = nodes[0].node_port;
-
-                            int peer_fd = establish_tcp_connection_from_ip4(nodes[2].node_ip, nodes[2].node_port);
-                            send_chord_packet(peer_fd, pkg);
-                            close(peer_fd);
-                            free(pkg);
-                            VLA_delete_by_index(pfds_VLA, i);  // keine Ahnung ob das wirklich richtig ist
-                        }
-                    } else if (request->type == PROTO_CHORD) {
-                        chord_packet *ring_message = (chord_packet *)request->contents;
-
-                        if (ring_message->action == REPLY) {
-                            debug("Got a reply, now I know who is responsible for the hash value. Trying to send answer to Client over one redirection.\n");
-                            client_info *client = NULL;
-                            HASH_FIND(hh, internal_hash_head, &ring_message->hash_id, sizeof(ring_message->hash_id), client);
-                            if (client == NULL) {
-                                warn("No client has sent a request with Key %#x. Something went wrong inside the ring or the client closed the connection.\n", ring_message->hash_id);
-                                continue;
-                                // TODO: bessere Fehlerbehebung, fds schließen etc
-                            }
-
-                            int peer_fd = establish_tcp_connection_from_ip4(ring_message->node_ip, ring_message->node_port);
-                            send_crud_packet(peer_fd, client->request);
-                            crud_packet *response = get_blank_crud_packet();
-                            receive_crud_packet(peer_fd, response, READ_CONTROL);
-                            VLA_delete_by_index(pfds_VLA, i);
-                            send_crud_packet(client->fd, response);
-                            HASH_DEL(internal_hash_head, client);
-                            free_crud_packet(client->request);
-                            free(client);
-                        } else if (ring_message->action == LOOKUP) {
-                            if (peer_stores_hashvalue(&nodes[2], ring_message->hash_id)) {
-                                debug("Got a lookup request, my successor is responsible for the hash value. Sending back answer to the origin of the lookup.\n");
-                                chord_packet *reply = get_blank_chord_packet();
-
-                                reply->action = REPLY;
-                                reply->hash_id = ring_message->hash_id;
-                                reply->node_id = nodes[2].node_id;
-                                reply->node_ip = nodes[2].node_ip;
-                                reply->node_port = nodes[2].node_port;
-
-                                int peer_fd = establish_tcp_connection_from_ip4(ring_message->node_ip, ring_message->node_port);
-                                send_chord_packet(peer_fd, reply);
-                                close(peer_fd);
-                                VLA_delete_by_index(pfds_VLA, i);
-                            } else {
-                                debug("Got a lookup request, but I also don't know who is responsible for the hash value. Forwarding lookup to my successor.\n");
-                                int peer_fd = establish_tcp_connection_from_ip4(nodes[2].node_ip, nodes[2].node_port);
-                                send_chord_packet(peer_fd, ring_message);
-                                close(peer_fd);
-                                VLA_delete_by_index(pfds_VLA, i);
-                            }
-                        }
-
-                        free(ring_message);
-                    }
-                }
-            }
+    while (is_running) {
+        reactor_run_once(event_loop, -1);
+        if (stats_requested) {
+            stats_requested = 0;
+            ds_print_stats();
+        }
+        if (persist_requested) {
+            persist_requested = 0;
+            ds_request_log_rewrite();
+            ds_request_snapshot();
         }
     }
 
+    reactor_stop_timer(event_loop, fix_fingers_timer);
+    reactor_stop_timer(event_loop, maintenance_timer);
+    reactor_destruct(event_loop);
+    pool_destruct();
     close(listener_fd);
     ds_destruct();
+    ring_layout_destruct(&layout);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
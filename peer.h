@@ -1,15 +1,85 @@
 #ifndef PEER_H
 #define PEER_H
 
+#define FORWARD_ATTEMPTS 2
+// So viele freigegebene Slots werden für die nächsten Anfragen aufgehoben
+#define RESPONSE_SLOT_CACHE_SIZE 256
+// So viele fertige Antworten gehen höchstens zusammen mit einem sendmsg() raus
+#define RESPONSE_BATCH_SIZE 64
+// Values ab dieser Größe gehen mit MSG_ZEROCOPY raus, darunter ist Kopieren billiger als das Festhalten der Seiten
+#define RESPONSE_ZEROCOPY_MIN_SIZE (64 * 1024)
+// fsync Policy für den Log, wenn keine mit -f angegeben ist: einmal pro Sekunde
+#define DEFAULT_FSYNC_INTERVAL 1000
+// Längster Abstand zwischen Snapshots im Hintergrund, der mit -S geht (ein Jahr)
+#define MAX_SNAPSHOT_INTERVAL (365 * 24 * 3600)
+
 #include <netinet/in.h>
 #include "uthash.h"
 #include "protocol.h"
+#include "reactor.h"
+#include "parser.h"
+#include "pool.h"
+#include "routecache.h"
+
+// Eine Anfrage auf einer Verbindung. Antworten werden in genau der Reihenfolge verschickt,
+// in der die Anfragen angekommen sind, auch wenn spätere Anfragen schneller fertig werden.
+typedef struct response_slot {
+    crud_packet* request;
+    crud_packet* response;                // NULL, solange die Antwort noch aussteht
+    struct pending_operation* operation;  // gesetzt, solange die Anfrage auf einen Lookup oder einen anderen Peer wartet
+    struct response_slot* next;
+} response_slot;
+
+// Ein sendmsg() mit MSG_ZEROCOPY. Der Kernel liest das Value erst beim eigentlichen Verschicken, owner muss also
+// so lange festgehalten werden, bis er mit der Nummer id auf der Error Queue vom Socket meldet, dass er fertig ist.
+typedef struct zerocopy_send {
+    uint32_t id;
+    shared_bytes* owner;
+    struct zerocopy_send* next;
+} zerocopy_send;
 
+// Kontext für eine angenommene Verbindung im epoll-Set. Verbindungen bleiben offen, bis die Gegenseite
+// fertig geschrieben hat und alle Antworten verschickt wurden, damit Clients viele Anfragen hintereinander schicken können.
 typedef struct {
+    reactor_handler handler;
+    packet_parser parser;
+    response_slot* queue_head;
+    response_slot* queue_tail;
+    size_t sent;  // so viele Bytes der ersten Antwort in der Warteschlange sind schon verschickt
+    zerocopy_send* zerocopy_head;  // in der Reihenfolge der Nummern, die der Kernel vergibt
+    zerocopy_send* zerocopy_tail;
+    uint32_t zerocopy_next;        // Nummer, die das nächste sendmsg() mit MSG_ZEROCOPY bekommt
+    uint zerocopy : 1;             // SO_ZEROCOPY ist auf dem Socket an
+    uint read_closed : 1;
+    uint write_blocked : 1;  // der Socket ist voll, es wird auf EPOLLOUT gewartet und solange nichts gelesen
+    uint deferring : 1;      // handle_connection_event() liest gerade, fertige Antworten warten bis zum Ende
+} connection;
+
+typedef enum {
+    OP_LOOKUP = 0,      // wartet auf ein REPLY, das sagt, welcher Peer zuständig ist
+    OP_FORWARD = 1,     // liegt beim zuständigen Peer und wartet auf dessen Antwort
+    OP_FIX_FINGER = 2,  // Lookup ohne Client, der einen Eintrag in der Finger Table aktualisiert
+    OP_PERSIST = 3,     // lokal ausgeführt, die Antwort wartet nur noch auf das fdatasync() vom Log
+} operation_state;
+
+// Eine Anfrage, die nicht sofort lokal beantwortet werden kann. Sie bekommt eine eindeutige Request ID,
+// die sowohl im LOOKUP und dem zugehörigen REPLY, als auch in der weitergeleiteten CRUD Anfrage und deren Antwort steht.
+// Damit lassen sich beliebig viele gleichzeitige Anfragen zuordnen, auch wenn ihre Keys auf den gleichen Hash-Wert fallen.
+typedef struct pending_operation {
     UT_hash_handle hh;
-    uint16_t key;
-    int fd;
-    crud_packet* request;
-} client_info;
+    uint32_t request_id;
+    operation_state state;
+    connection* conn;        // NULL, wenn der Client inzwischen nicht mehr da ist
+    response_slot* slot;
+    pooled_connection* via;  // Verbindung, über die die Anfrage zuletzt weitergeleitet oder nachgeschlagen wurde
+    uint32_t ip4;
+    uint16_t port;
+    int attempts;
+    int lookups;       // so oft wurde schon nachgeschlagen, weil der Peer aus dem Route Cache nicht mehr zuständig war
+    int finger_index;  // nur bei OP_FIX_FINGER
+    uint64_t log_position;              // nur bei OP_PERSIST: so weit muss der Log gesynct sein
+    crud_packet* response;              // nur bei OP_PERSIST: die fertige Antwort
+    struct pending_operation* next;     // nur bei OP_PERSIST: nächste Operation, die auf den Log wartet
+} pending_operation;
 
 #endif
\ No newline at end of file
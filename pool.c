@@ -0,0 +1,248 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "pool.h"
+#include "debug.h"
+
+// wird von uthash gebraucht, um Hash Table zu erstellen
+pooled_connection *pool_hash_head = NULL;
+
+reactor *pool_reactor = NULL;
+pool_packet_handler pool_on_packet = NULL;
+pool_failure_handler pool_on_failure = NULL;
+
+// on_packet bekommt jedes Paket, das auf einer Pool-Verbindung ankommt (also Antworten auf weitergeleitete Anfragen),
+// on_failure wird aufgerufen, wenn eine Verbindung kaputt geht, damit ausstehende Anfragen nicht ewig warten.
+void pool_initialize(reactor *r, pool_packet_handler on_packet, pool_failure_handler on_failure) {
+    pool_reactor = r;
+    pool_on_packet = on_packet;
+    pool_on_failure = on_failure;
+}
+
+static void pool_free_message(pool_message *m) {
+    shared_bytes_release(m->key.owner);
+    shared_bytes_release(m->value.owner);
+    free(m);
+}
+
+// Pakete, die bis hierhin nicht rausgegangen sind, werden verworfen
+static void pool_destroy_connection(reactor_handler *h) {
+    pooled_connection *pc = h->context;
+    parser_destruct(&pc->parser);
+    while (pc->queue_head != NULL) {
+        pool_message *m = pc->queue_head;
+        pc->queue_head = m->next;
+        pool_free_message(m);
+    }
+    free(pc);
+}
+
+// Hängt ein leeres Paket hinten an die Warteschlange von pc an
+static pool_message *pool_enqueue(pooled_connection *pc) {
+    pool_message *m = malloc(sizeof(pool_message));
+    if (m == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    m->prefix_length = 0;
+    m->key = (bytebuffer){.contents = NULL, .owner = NULL, .length = 0};
+    m->value = (bytebuffer){.contents = NULL, .owner = NULL, .length = 0};
+    m->next = NULL;
+
+    if (pc->queue_tail == NULL) {
+        pc->queue_head = m;
+    } else {
+        pc->queue_tail->next = m;
+    }
+    pc->queue_tail = m;
+    return m;
+}
+
+// Hält Key oder Value für die Warteschlange fest. Gehört der Speicher niemandem, kann er nach dem Aufruf weg sein
+// und wird kopiert, sonst reicht eine Referenz.
+static void pool_hold_bytes(bytebuffer *to, bytebuffer *from) {
+    if (from->owner != NULL) {
+        bytebuffer_shallow_copy(to, from);
+        return;
+    }
+    bytebuffer_allocate(to, from->length);
+    if (from->length > 0) memcpy(to->contents, from->contents, from->length);
+}
+
+// Schickt die Warteschlange von pc ab, so weit der Socket es zulässt. Wie bei den Antworten an Clients gehen bis zu
+// POOL_BATCH_SIZE Pakete mit einem sendmsg() raus, und ist der Socket voll, geht es weiter, sobald epoll EPOLLOUT
+// meldet. Der Peer wartet also nie darauf, dass ein anderer Peer liest. Bei einem Fehler wird die Verbindung aufgegeben.
+static void pool_flush(pooled_connection *pc) {
+    struct iovec iov[POOL_BATCH_SIZE * CRUD_IOVEC_COUNT];
+    size_t lengths[POOL_BATCH_SIZE];
+    int blocked = 0;
+
+    while (pc->queue_head != NULL && !blocked) {
+        int count = 0;
+        int batched = 0;
+        for (pool_message *m = pc->queue_head; m != NULL && batched < POOL_BATCH_SIZE; m = m->next) {
+            iov[count++] = (struct iovec){.iov_base = m->prefix, .iov_len = m->prefix_length};
+            if (m->key.length > 0) iov[count++] = (struct iovec){.iov_base = m->key.contents, .iov_len = m->key.length};
+            if (m->value.length > 0) iov[count++] = (struct iovec){.iov_base = m->value.contents, .iov_len = m->value.length};
+            lengths[batched++] = m->prefix_length + m->key.length + m->value.length;
+        }
+
+        int completed = send_iovec_messages(pc->handler.fd, iov, count, lengths, batched, &pc->sent, &blocked);
+        if (completed < 0) {
+            warn("%s\n", strerror(errno));
+            pool_invalidate(pc);
+            return;
+        }
+
+        // Alle Pakete, die jetzt komplett draußen sind, werden freigegeben
+        for (; completed > 0; completed--) {
+            pool_message *m = pc->queue_head;
+            pc->queue_head = m->next;
+            if (pc->queue_head == NULL) pc->queue_tail = NULL;
+            pool_free_message(m);
+        }
+    }
+
+    reactor_modify(pool_reactor, &pc->handler, pc->queue_head != NULL ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+// Nur wenn das Paket allein in der Warteschlange steht, kann es sofort raus. Sonst ist der Socket gerade voll
+// oder noch nicht verbunden, und es geht mit den anderen zusammen bei EPOLLOUT raus.
+static void pool_submit(pooled_connection *pc, pool_message *m) {
+    if (!pc->connecting && pc->queue_head == m) pool_flush(pc);
+}
+
+static void pool_handle_event(reactor_handler *h, uint32_t events) {
+    pooled_connection *pc = h->context;
+
+    if (pc->connecting) {
+        int error = 0;
+        if (getsockopt(h->fd, SOL_SOCKET, SO_ERROR, &error, (socklen_t[]){sizeof(error)}) == -1) error = errno;
+        if (error != 0) {
+            char *ip4_repr = ip4_to_string(&(struct in_addr){.s_addr = pc->ip4});
+            warn("%s. Couldn't establish a connection with %s:%d.\n", strerror(error), ip4_repr, ntohs(pc->port));
+            free(ip4_repr);
+            pool_invalidate(pc);
+            return;
+        }
+        // Der Handshake ist durch, jetzt kann alles raus, was sich inzwischen angesammelt hat
+        pc->connecting = 0;
+        events |= EPOLLOUT;
+    }
+
+    if (events & EPOLLOUT) {
+        pool_flush(pc);
+        if (h->retired || !(events & (EPOLLIN | EPOLLERR | EPOLLHUP))) return;
+    }
+
+    while (!h->retired) {
+        generic_packet pkg;
+        parser_status status = parser_receive(&pc->parser, h->fd, &pkg);
+        if (status == PARSER_INCOMPLETE) return;
+        if (status != PARSER_COMPLETE) {
+            debug("Pooled connection on socket %d was closed.\n", h->fd);
+            pool_invalidate(pc);
+            return;
+        }
+
+        pool_on_packet(pc, &pkg);
+    }
+}
+
+static uint64_t pool_address(uint32_t ip4, uint16_t port) {
+    return ((uint64_t)ip4 << 16) | port;
+}
+
+// Gibt eine offene Verbindung zu ip4:port zurück und baut nur dann eine neue auf,
+// wenn es noch keine gibt oder die alte kaputt ist. So kostet eine Weiterleitung nur noch einen RTT statt einem Handshake.
+// Eine neue Verbindung ist erst im Aufbau, bis dahin bleiben Pakete in der Warteschlange. Schlägt der Aufbau später fehl,
+// wird sie über pool_invalidate() aufgegeben. Kann er gar nicht erst anfangen, wird NULL zurückgegeben.
+// Ob die Gegenseite eine Verbindung aus dem Pool inzwischen geschlossen hat, wird hier nicht extra geprüft. Das meldet
+// epoll über EPOLLIN, und was bis dahin noch darüber rausging, schickt on_failure über eine neue Verbindung nochmal.
+pooled_connection *pool_get_connection(uint32_t ip4, uint16_t port) {
+    uint64_t address = pool_address(ip4, port);
+    pooled_connection *pc = NULL;
+    HASH_FIND(hh, pool_hash_head, &address, sizeof(address), pc);
+    if (pc != NULL) return pc;
+
+    int fd = start_tcp_connection_from_ip4(ip4, port);
+    if (fd == -1) return NULL;
+    // Weitergeleitete Anfragen und Chord Pakete gehen sofort raus, ohne TCP_NODELAY würde Nagle sie zurückhalten
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (int[]){1}, sizeof(int)) == -1) {
+        warn("%s\n", strerror(errno));
+    }
+
+    pc = malloc(sizeof(pooled_connection));
+    if (pc == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    reactor_handler_init(&pc->handler, fd, pool_handle_event, pool_destroy_connection, pc);
+    parser_initialize(&pc->parser);
+    pc->address = address;
+    pc->ip4 = ip4;
+    pc->port = port;
+    pc->queue_head = NULL;
+    pc->queue_tail = NULL;
+    pc->sent = 0;
+    pc->connecting = 1;
+    if (reactor_register(pool_reactor, &pc->handler, EPOLLIN | EPOLLOUT) == -1) {
+        warn("Couldn't watch pooled connection.\n");
+        close(fd);
+        pool_destroy_connection(&pc->handler);
+        return NULL;
+    }
+    HASH_ADD(hh, pool_hash_head, address, sizeof(pc->address), pc);
+    debug("Added connection on socket %d to the pool.\n", fd);
+
+    return pc;
+}
+
+// Schließt die Verbindung, zB. nachdem beim Senden oder Empfangen ein Fehler aufgetreten ist.
+// Sie wird vorher aus dem Pool genommen, damit on_failure ausstehende Anfragen direkt über eine neue Verbindung schicken kann.
+void pool_invalidate(pooled_connection *pc) {
+    if (pc->handler.retired) return;
+
+    HASH_DEL(pool_hash_head, pc);
+    reactor_retire(pool_reactor, &pc->handler);
+    close(pc->handler.fd);
+    if (pool_on_failure != NULL) pool_on_failure(pc);
+}
+
+// Stellt pkg mit request_id als Request ID in die Warteschlange von pc, pkg selbst bleibt dabei unverändert.
+// Key und Value werden nicht kopiert. Geht das Senden schief, wird pc über pool_invalidate() aufgegeben, der Aufrufer
+// darf sich danach also auf nichts mehr verlassen, was on_failure freigeben könnte.
+void pool_send_crud_packet(pooled_connection *pc, crud_packet *pkg, uint32_t request_id) {
+    pool_message *m = pool_enqueue(pc);
+    unsigned int original_reserved = pkg->reserved;
+    uint32_t original_request_id = pkg->request_id;
+    pkg->reserved |= CRUD_FLAG_REQUEST_ID;
+    pkg->request_id = request_id;
+    m->prefix_length = encode_crud_prefix(pkg, m->prefix);
+    pkg->reserved = original_reserved;
+    pkg->request_id = original_request_id;
+    pool_hold_bytes(&m->key, pkg->key);
+    pool_hold_bytes(&m->value, pkg->value);
+
+    pool_submit(pc, m);
+}
+
+// Chord Nachrichten brauchen keine Antwort auf der gleichen Verbindung, deswegen können sich
+// beliebig viele davon eine Verbindung teilen. pkg wird dabei in die Warteschlange kopiert.
+// Fehler beim Senden behandelt pool_send_crud_packet() genauso.
+void pool_send_chord_packet(pooled_connection *pc, chord_packet *pkg) {
+    debug("Sending chord packet with action = %#x, Request ID = %u, Hash ID = %#x over socket %d.\n", pkg->action, pkg->request_id, pkg->hash_id, pc->handler.fd);
+    pool_message *m = pool_enqueue(pc);
+    m->prefix_length = encode_chord_packet(pkg, m->prefix);
+    pool_submit(pc, m);
+}
+
+void pool_destruct() {
+    pooled_connection *current, *tmp;
+
+    HASH_ITER(hh, pool_hash_head, current, tmp) {
+        HASH_DEL(pool_hash_head, current);
+        close(current->handler.fd);
+        pool_destroy_connection(&current->handler);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include "uthash.h"
+#include "protocol.h"
+#include "reactor.h"
+#include "parser.h"
+
+// So viele wartende Pakete gehen höchstens zusammen mit einem sendmsg() raus
+#define POOL_BATCH_SIZE 64
+#define POOL_PREFIX_SIZE (CRUD_MAX_PREFIX_SIZE > CHORD_MAX_ENCODED_SIZE ? CRUD_MAX_PREFIX_SIZE : CHORD_MAX_ENCODED_SIZE)
+
+// Ein Paket, das noch nicht (ganz) auf dem Socket ist. Ein Chord Paket steht komplett in prefix, bei CRUD Paketen
+// kommen Key und Value dahinter. Die werden nicht kopiert, die bytebuffer halten nur Referenzen darauf.
+typedef struct pool_message {
+    uint8_t prefix[POOL_PREFIX_SIZE];
+    size_t prefix_length;
+    bytebuffer key;
+    bytebuffer value;
+    struct pool_message* next;
+} pool_message;
+
+// Eine offene Verbindung zu einem anderen Peer, die für viele Anfragen wiederverwendet wird.
+// address ist IP und Port (beide in Network Byte Order) zusammen, damit man mit einem Schlüssel suchen kann.
+// Die Verbindung hängt selbst in der Event Loop, damit Antworten ankommen können, ohne dass jemand darauf wartet.
+typedef struct pooled_connection {
+    reactor_handler handler;
+    UT_hash_handle hh;
+    uint64_t address;
+    uint32_t ip4;
+    uint16_t port;
+    packet_parser parser;
+    pool_message* queue_head;  // wird der Reihe nach verschickt, ohne dass der Peer dabei blockiert
+    pool_message* queue_tail;
+    size_t sent;  // so viele Bytes vom ersten Paket in der Warteschlange sind schon verschickt
+    unsigned int connecting : 1;  // der Handshake läuft noch, bis EPOLLOUT kommt
+} pooled_connection;
+
+// pkg gehört dem Aufrufer und gilt nur während des Aufrufs, pkg->contents dagegen gehört ab dann dem Handler
+typedef void (*pool_packet_handler)(pooled_connection* pc, generic_packet* pkg);
+typedef void (*pool_failure_handler)(pooled_connection* pc);
+
+void pool_initialize(reactor* r, pool_packet_handler on_packet, pool_failure_handler on_failure);
+pooled_connection* pool_get_connection(uint32_t ip4, uint16_t port);
+void pool_invalidate(pooled_connection* pc);
+void pool_send_crud_packet(pooled_connection* pc, crud_packet* pkg, uint32_t request_id);
+void pool_send_chord_packet(pooled_connection* pc, chord_packet* pkg);
+void pool_destruct();
+
+#endif
\ No newline at end of file
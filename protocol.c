@@ -5,24 +5,28 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <netdb.h>
-#include <time.h>
 #include "protocol.h"
 #include "debug.h"
 
+// wird in debug.h nur deklariert, damit es nicht in jeder Übersetzungseinheit neu definiert wird
+char *dbg_identifier = NULL;
+
 chord_packet *get_blank_chord_packet() {
     chord_packet *blank = malloc(sizeof(chord_packet));
     if (blank == NULL) {
         panic("%s\n", strerror(errno));
     }
 
-    memset(blank, 0, sizeof(blank));
+    memset(blank, 0, sizeof(chord_packet));
     return blank;
 }
 
 void parse_chord_control(int socket_fd, chord_packet *pkg, uint8_t *control) {
-    pkg->reserved = control[0] & 0xfc;
+    // Bit 7 markiert nur, dass es ein Chord Paket ist, und gehört nicht zu reserved
+    pkg->reserved = (control[0] & 0x7c) >> 2;
     pkg->action = control[0] & 0x03;
 }
 
@@ -34,6 +38,25 @@ void receive_chord_packet(int socket_fd, chord_packet *pkg, parse_mode m) {
     }
 
     uint8_t *contents = read_n_bytes_from_file(socket_fd, CHORD_PACKET_SIZE);
+    decode_chord_body(pkg, contents);
+
+    uint8_t *extensions = read_n_bytes_from_file(socket_fd, chord_extension_size(pkg));
+    if (extensions != NULL) {
+        decode_chord_extensions(pkg, extensions);
+        free(extensions);
+    }
+
+    struct in_addr ip_wrapper = {
+        .s_addr = pkg->node_ip,
+    };
+    char *ip4_repr = ip4_to_string(&ip_wrapper);
+    debug("Got chord packet with action = %#x, Hash ID = %#x, Node IP = %s and Node Port = %d from socket %d.\n", pkg->action, pkg->hash_id, ip4_repr, ntohs(pkg->node_port), socket_fd);
+    free(ip4_repr);
+    free(contents);
+}
+
+// Liest die CHORD_PACKET_SIZE Bytes nach dem Kontrollbyte aus contents aus
+void decode_chord_body(chord_packet *pkg, uint8_t *contents) {
     size_t read_offset = 0;
 
     memcpy(&pkg->hash_id, contents + read_offset, sizeof(pkg->hash_id));
@@ -49,33 +72,82 @@ void receive_chord_packet(int socket_fd, chord_packet *pkg, parse_mode m) {
 
     memcpy(&pkg->node_port, contents + read_offset, sizeof(pkg->node_port));
     read_offset += sizeof(pkg->node_port);
+}
 
-    struct in_addr ip_wrapper = {
-        .s_addr = pkg->node_ip,
-    };
-    char *ip4_repr = ip4_to_string(&ip_wrapper);
-    debug("Got chord packet with action = %#x, Hash ID = %#x, Node IP = %s and Node Port = %d from socket %d.\n", pkg->action, pkg->hash_id, ip4_repr, ntohs(pkg->node_port), socket_fd);
-    free(ip4_repr);
-    free(contents);
+// Anzahl der Bytes, die wegen der gesetzten Bits in reserved noch nach dem Body kommen
+uint32_t chord_extension_size(chord_packet *pkg) {
+    uint32_t size = 0;
+    if (pkg->reserved & CHORD_FLAG_REQUEST_ID) size += CHORD_REQUEST_ID_SIZE;
+    if (pkg->reserved & CHORD_FLAG_RANGE) size += CHORD_RANGE_SIZE;
+    return size;
 }
 
-int send_chord_packet(int socket_fd, chord_packet *pkg) {
-    uint8_t header = 0x80 | (pkg->reserved << 2) | pkg->action;
+// Liest die chord_extension_size(pkg) Bytes nach dem Body aus extensions aus
+void decode_chord_extensions(chord_packet *pkg, uint8_t *extensions) {
+    size_t read_offset = 0;
+
+    if (pkg->reserved & CHORD_FLAG_REQUEST_ID) {
+        memcpy(&pkg->request_id, extensions + read_offset, sizeof(pkg->request_id));
+        pkg->request_id = ntohl(pkg->request_id);
+        read_offset += sizeof(pkg->request_id);
+    }
+
+    if (pkg->reserved & CHORD_FLAG_RANGE) {
+        memcpy(&pkg->area_start, extensions + read_offset, sizeof(pkg->area_start));
+        pkg->area_start = ntohs(pkg->area_start);
+        read_offset += sizeof(pkg->area_start);
+
+        memcpy(&pkg->area_stop, extensions + read_offset, sizeof(pkg->area_stop));
+        pkg->area_stop = ntohs(pkg->area_stop);
+        read_offset += sizeof(pkg->area_stop);
+    }
+}
+
+// Schreibt pkg in der Form nach destination, in der es über den Socket geht, und gibt die Länge zurück.
+// destination muss mindestens CHORD_MAX_ENCODED_SIZE Bytes groß sein.
+size_t encode_chord_packet(chord_packet *pkg, uint8_t *destination) {
+    uint8_t *start = destination;
     uint16_t nw_hash_id = htons(pkg->hash_id);
     uint16_t nw_node_id = htons(pkg->node_id);
 
+    *destination++ = 0x80 | (pkg->reserved << 2) | pkg->action;
+    memcpy(destination, &nw_hash_id, sizeof(nw_hash_id));
+    destination += sizeof(nw_hash_id);
+    memcpy(destination, &nw_node_id, sizeof(nw_node_id));
+    destination += sizeof(nw_node_id);
+    memcpy(destination, &pkg->node_ip, sizeof(pkg->node_ip));
+    destination += sizeof(pkg->node_ip);
+    memcpy(destination, &pkg->node_port, sizeof(pkg->node_port));
+    destination += sizeof(pkg->node_port);
+    if (pkg->reserved & CHORD_FLAG_REQUEST_ID) {
+        uint32_t nw_request_id = htonl(pkg->request_id);
+        memcpy(destination, &nw_request_id, sizeof(nw_request_id));
+        destination += sizeof(nw_request_id);
+    }
+    if (pkg->reserved & CHORD_FLAG_RANGE) {
+        uint16_t nw_area_start = htons(pkg->area_start);
+        uint16_t nw_area_stop = htons(pkg->area_stop);
+        memcpy(destination, &nw_area_start, sizeof(nw_area_start));
+        destination += sizeof(nw_area_start);
+        memcpy(destination, &nw_area_stop, sizeof(nw_area_stop));
+        destination += sizeof(nw_area_stop);
+    }
+
+    return destination - start;
+}
+
+// Das ganze Paket geht mit einem einzigen send() raus, statt Feld für Feld
+int send_chord_packet(int socket_fd, chord_packet *pkg) {
     struct in_addr ip_wrapper = {
         .s_addr = pkg->node_ip,
     };
     char *ip4_repr = ip4_to_string(&ip_wrapper);
-    debug("Sending chord packet with action = %#x, Hash ID = %#x, Node IP = %s and Node Port = %d over socket %d.\n", pkg->action, pkg->hash_id, ip4_repr, ntohs(pkg->node_port), socket_fd);
+    debug("Sending chord packet with action = %#x, Request ID = %u, Hash ID = %#x, Node IP = %s and Node Port = %d over socket %d.\n", pkg->action, pkg->request_id, pkg->hash_id, ip4_repr, ntohs(pkg->node_port), socket_fd);
     free(ip4_repr);
 
-    if (write_n_bytes_to_file(socket_fd, &header, sizeof(uint8_t)) < 0 ||
-        write_n_bytes_to_file(socket_fd, (uint8_t *)&nw_hash_id, sizeof(nw_hash_id)) < 0 ||
-        write_n_bytes_to_file(socket_fd, (uint8_t *)&nw_node_id, sizeof(nw_node_id)) < 0 ||
-        write_n_bytes_to_file(socket_fd, (uint8_t *)&pkg->node_ip, sizeof(pkg->node_ip)) < 0 ||
-        write_n_bytes_to_file(socket_fd, (uint8_t *)&pkg->node_port, sizeof(pkg->node_port)) < 0) {
+    uint8_t encoded[CHORD_MAX_ENCODED_SIZE];
+    size_t length = encode_chord_packet(pkg, encoded);
+    if (write_n_bytes_to_file(socket_fd, encoded, length) < 0) {
         warn("Failed to send packet.\n");
         return -1;
     }
@@ -103,6 +175,32 @@ int peer_stores_hashvalue(peer *peer, uint16_t hash_value) {
     return hash_value >= peer->area_start && hash_value <= peer->area_stop;
 }
 
+// Füllt node_id, node_ip und node_port von p aus den Kommandozeilen-Strings. Der Port wird in Network Byte Order gespeichert.
+int parse_peer_address(peer *p, char *id, char *host, char *port) {
+    if (!string_to_uint16(id, &p->node_id)) {
+        panic("Error converting node ID.\n");
+    }
+    if (!string_to_uint16(port, &p->node_port)) {
+        panic("Error converting node port.\n");
+    }
+    p->node_port = htons(p->node_port);
+
+    struct addrinfo peer_hints, *peer_address_list;
+    memset(&peer_hints, 0, sizeof peer_hints);
+    peer_hints.ai_family = AF_INET;        // nur IPv4 zulassen
+    peer_hints.ai_socktype = SOCK_STREAM;  // rede über TCP mit Server
+
+    int info_success = getaddrinfo(host, port, &peer_hints, &peer_address_list);
+    if (info_success != 0) {
+        warn("%s\n", gai_strerror(info_success));
+        return -1;
+    }
+
+    p->node_ip = ((struct sockaddr_in *)peer_address_list->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(peer_address_list);
+    return 0;
+}
+
 peer *setup_ring_neighbours(char *information[]) {
     // nodes[0]: Eigene Node
     // nodes[1]: Vorgängernode
@@ -113,26 +211,7 @@ peer *setup_ring_neighbours(char *information[]) {
     }
 
     for (int i = 1; i < 10; i += 3) {
-        if (!string_to_uint16(information[i], &nodes[i / 3].node_id)) {
-            panic("Error converting node ID.\n");
-        }
-        if (!string_to_uint16(information[i + 2], &nodes[i / 3].node_port)) {
-            panic("Error converting node port.\n");
-        }
-        nodes[i / 3].node_port = htons(nodes[i / 3].node_port);
-
-        struct addrinfo peer_hints, *peer_address_list;
-        memset(&peer_hints, 0, sizeof peer_hints);
-        peer_hints.ai_family = AF_INET;        // nur IPv4 zulassen
-        peer_hints.ai_socktype = SOCK_STREAM;  // rede über TCP mit Server
-
-        int info_success = getaddrinfo(information[i + 1], information[i + 2], &peer_hints, &peer_address_list);
-        if (info_success != 0) {
-            warn("%s\n", gai_strerror(info_success));
-            return NULL;
-        }
-
-        nodes[i / 3].node_ip = ((struct sockaddr_in *)peer_address_list->ai_addr)->sin_addr.s_addr;
+        if (parse_peer_address(&nodes[i / 3], information[i], information[i + 1], information[i + 2]) < 0) return NULL;
     }
 
     nodes[0].area_start = nodes[1].node_id + 1;
@@ -148,20 +227,48 @@ peer *setup_ring_neighbours(char *information[]) {
     return nodes;
 }
 
+// Paket, key und value in einem Block, damit ein Paket vom Parser nur eine Allokation kostet statt drei
+typedef struct blank_crud_packet {
+    crud_packet packet;
+    bytebuffer key;
+    bytebuffer value;
+    struct blank_crud_packet *next_free;
+} blank_crud_packet;
+
+// Freigegebene Blöcke werden hier für die nächsten Pakete aufgehoben, im Normalfall wird also gar nichts allokiert.
+// Pakete werden nur vom Hauptthread angelegt und freigegeben, deswegen ohne Lock.
+static blank_crud_packet *free_crud_packets = NULL;
+static size_t free_crud_packet_count = 0;
+
 crud_packet *get_blank_crud_packet() {
-    crud_packet *blank = malloc(sizeof(crud_packet));
-    if (blank == NULL) {
-        panic("%s\n", strerror(errno));
+    blank_crud_packet *blank = free_crud_packets;
+    if (blank != NULL) {
+        free_crud_packets = blank->next_free;
+        free_crud_packet_count--;
+    } else {
+        blank = malloc(sizeof(blank_crud_packet));
+        if (blank == NULL) {
+            panic("%s\n", strerror(errno));
+        }
     }
 
-    blank->reserved = 0;
-    blank->action = 0;
-    blank->key = initialize_bytebuffer_with_values(NULL, 0);
-    blank->key->contents_are_freeable = 0;
-    blank->value = initialize_bytebuffer_with_values(NULL, 0);
-    blank->value->contents_are_freeable = 0;
+    crud_packet *pkg = &blank->packet;
+    pkg->reserved = 0;
+    pkg->action = 0;
+    pkg->request_id = 0;
+    pkg->ttl = 0;
+    pkg->key = &blank->key;
+    pkg->key->contents = NULL;
+    pkg->key->owner = NULL;
+    pkg->key->length = 0;
+    pkg->value = &blank->value;
+    pkg->value->contents = NULL;
+    pkg->value->owner = NULL;
+    pkg->value->length = 0;
+    pkg->embedded = 1;
+    pkg->value_in_file = 0;
 
-    return blank;
+    return pkg;
 }
 
 crud_packet *initialize_crud_packet_with_values(crud_action a, bytebuffer *key, bytebuffer *value) {
@@ -178,9 +285,23 @@ crud_packet *initialize_crud_packet_with_values(crud_action a, bytebuffer *key,
 }
 
 void free_crud_packet(crud_packet *pkg) {
-    free_bytebuffer(pkg->key);
-    free_bytebuffer(pkg->value);
-    free(pkg);
+    if (!pkg->embedded) {
+        free_bytebuffer(pkg->key);
+        free_bytebuffer(pkg->value);
+        free(pkg);
+        return;
+    }
+
+    shared_bytes_release(pkg->key->owner);
+    shared_bytes_release(pkg->value->owner);
+    blank_crud_packet *blank = (blank_crud_packet *)pkg;
+    if (free_crud_packet_count >= CRUD_PACKET_CACHE_SIZE) {
+        free(blank);
+        return;
+    }
+    blank->next_free = free_crud_packets;
+    free_crud_packets = blank;
+    free_crud_packet_count++;
 }
 
 void parse_crud_control(int socket_fd, crud_packet *pkg, uint8_t *control) {
@@ -188,6 +309,167 @@ void parse_crud_control(int socket_fd, crud_packet *pkg, uint8_t *control) {
     pkg->action = control[0] & 0x0f;
 }
 
+int crud_action_is_valid(crud_action a) {
+    crud_action ack_masked = a & 0x07;
+    return ack_masked == GET || ack_masked == SET || ack_masked == DEL;
+}
+
+// Liest Key- und Value-Länge aus den CRUD_HEADER_SIZE Bytes nach dem Kontrollbyte aus.
+// Die Längenfelder landen direkt in pkg->key->length und pkg->value->length.
+void decode_crud_header(crud_packet *pkg, uint8_t *header) {
+    uint16_t key_length;
+    memcpy(&key_length, header, sizeof(key_length));
+    pkg->key->length = ntohs(key_length);
+
+    uint32_t value_length;
+    memcpy(&value_length, header + sizeof(key_length), sizeof(value_length));
+    pkg->value->length = ntohl(value_length);
+}
+
+// Anzahl der Bytes, die wegen der gesetzten Bits in reserved noch zwischen Header und Key kommen
+uint32_t crud_extension_size(crud_packet *pkg) {
+    uint32_t size = 0;
+    if (pkg->reserved & CRUD_FLAG_REQUEST_ID) size += CRUD_REQUEST_ID_SIZE;
+    if (pkg->reserved & CRUD_FLAG_TTL) size += CRUD_TTL_SIZE;
+    return size;
+}
+
+void decode_crud_extensions(crud_packet *pkg, uint8_t *extensions) {
+    size_t read_offset = 0;
+
+    if (pkg->reserved & CRUD_FLAG_REQUEST_ID) {
+        memcpy(&pkg->request_id, extensions + read_offset, sizeof(pkg->request_id));
+        pkg->request_id = ntohl(pkg->request_id);
+        read_offset += sizeof(pkg->request_id);
+    }
+
+    if (pkg->reserved & CRUD_FLAG_TTL) {
+        memcpy(&pkg->ttl, extensions + read_offset, sizeof(pkg->ttl));
+        pkg->ttl = ntohl(pkg->ttl);
+        read_offset += sizeof(pkg->ttl);
+    }
+}
+
+// So viele Bytes belegt pkg in der Form, in der es auch über den Socket geht
+size_t crud_encoded_size(crud_packet *pkg) {
+    return 1 + CRUD_HEADER_SIZE + crud_extension_size(pkg) + pkg->key->length + pkg->value->length;
+}
+
+// Schreibt Kontrollbyte, Header und Erweiterungsfelder von pkg nach destination und gibt zurück, wie viele Bytes das sind.
+// destination muss mindestens CRUD_MAX_PREFIX_SIZE Bytes groß sein. Danach kommen auf dem Socket nur noch Key und Value.
+size_t encode_crud_prefix(crud_packet *pkg, uint8_t *destination) {
+    uint8_t *start = destination;
+    uint8_t flags = (pkg->reserved << 4) | pkg->action;
+    uint16_t nw_key_length = htons((uint16_t)pkg->key->length);
+    uint32_t nw_value_length = htonl(pkg->value->length);
+
+    *destination++ = flags;
+    memcpy(destination, &nw_key_length, sizeof(nw_key_length));
+    destination += sizeof(nw_key_length);
+    memcpy(destination, &nw_value_length, sizeof(nw_value_length));
+    destination += sizeof(nw_value_length);
+    if (pkg->reserved & CRUD_FLAG_REQUEST_ID) {
+        uint32_t nw_request_id = htonl(pkg->request_id);
+        memcpy(destination, &nw_request_id, sizeof(nw_request_id));
+        destination += sizeof(nw_request_id);
+    }
+    if (pkg->reserved & CRUD_FLAG_TTL) {
+        uint32_t nw_ttl = htonl(pkg->ttl);
+        memcpy(destination, &nw_ttl, sizeof(nw_ttl));
+        destination += sizeof(nw_ttl);
+    }
+
+    return destination - start;
+}
+
+// Schreibt pkg genauso nach destination, wie send_crud_packet() es verschicken würde.
+// destination muss mindestens crud_encoded_size(pkg) Bytes groß sein.
+void encode_crud_packet(crud_packet *pkg, uint8_t *destination) {
+    destination += encode_crud_prefix(pkg, destination);
+    if (pkg->key->length > 0) memcpy(destination, pkg->key->contents, pkg->key->length);
+    destination += pkg->key->length;
+    if (pkg->value->length > 0) memcpy(destination, pkg->value->contents, pkg->value->length);
+}
+
+// Beschreibt pkg als bis zu CRUD_IOVEC_COUNT iovecs, ohne Key und Value zu kopieren. Der Präfix wird dafür nach prefix
+// geschrieben, das mindestens CRUD_MAX_PREFIX_SIZE Bytes groß sein muss. Gibt die Anzahl der iovecs zurück.
+// Steht das Value in einer Datei (value_in_file), fehlt es in den iovecs und muss hinterher geschickt werden.
+int crud_packet_iovec(crud_packet *pkg, uint8_t *prefix, struct iovec *iov) {
+    int count = 0;
+    iov[count++] = (struct iovec){.iov_base = prefix, .iov_len = encode_crud_prefix(pkg, prefix)};
+    if (pkg->key->length > 0) iov[count++] = (struct iovec){.iov_base = pkg->key->contents, .iov_len = pkg->key->length};
+    if (pkg->value->length > 0 && !pkg->value_in_file) iov[count++] = (struct iovec){.iov_base = pkg->value->contents, .iov_len = pkg->value->length};
+    return count;
+}
+
+// Überspringt die ersten bytes Bytes in iov, zB. nachdem sendmsg() nur einen Teil geschickt hat.
+// Gibt zurück, wie viele iovecs danach noch übrig sind, iov selbst wird dabei angepasst.
+int iovec_advance(struct iovec **iov, int count, size_t bytes) {
+    while (count > 0 && bytes >= (*iov)->iov_len) {
+        bytes -= (*iov)->iov_len;
+        (*iov)++;
+        count--;
+    }
+    if (count > 0) {
+        (*iov)->iov_base = (uint8_t *)(*iov)->iov_base + bytes;
+        (*iov)->iov_len -= bytes;
+    }
+    return count;
+}
+
+// Schickt alle iovecs auf einmal mit sendmsg(), bei blockierenden Sockets also meistens mit einem einzigen Syscall.
+// Schreibt der Kernel nur einen Teil, wird der Rest hinterhergeschickt.
+int send_iovec(int socket_fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        struct msghdr message = {.msg_iov = iov, .msg_iovlen = count};
+        ssize_t bytes_sent = sendmsg(socket_fd, &message, MSG_NOSIGNAL);  // geschlossene Gegenseite soll kein SIGPIPE auslösen, sondern nur einen Fehler
+        if (bytes_sent < 0) {
+            if (errno == EINTR) continue;
+            warn("%s\n", strerror(errno));
+            return -1;
+        }
+        count = iovec_advance(&iov, count, bytes_sent);
+    }
+
+    return 0;
+}
+
+// Für Warteschlangen aus Nachrichten, die über mehrere nicht blockierende Aufrufe verschickt werden: *sent ist der Teil
+// der ersten Nachricht, der schon draußen war, und bytes sind gerade dazugekommen. lengths[i] ist die Länge der i-ten
+// Nachricht. Gibt zurück, wie viele der Nachrichten jetzt komplett draußen sind, danach steht in *sent der Teil
+// der nächsten, der schon verschickt ist.
+int iovec_messages_done(size_t *sent, size_t bytes, const size_t *lengths, int messages) {
+    size_t done = *sent + bytes;
+    int completed = 0;
+    while (completed < messages && done >= lengths[completed]) {
+        done -= lengths[completed++];
+    }
+    *sent = done;
+    return completed;
+}
+
+// Schickt messages Nachrichten, die zusammen in iov stehen, ab Byte *sent der ersten mit einem nicht blockierenden
+// sendmsg(). Gibt wie iovec_messages_done() zurück, wie viele davon jetzt komplett draußen sind. Hat der Socket nicht
+// alles genommen, wird *blocked gesetzt, dann geht es erst nach EPOLLOUT weiter. Bei einem Fehler kommt -1 zurück,
+// errno bleibt stehen. iov wird dabei verändert.
+int send_iovec_messages(int socket_fd, struct iovec *iov, int count, const size_t *lengths, int messages, size_t *sent, int *blocked) {
+    count = iovec_advance(&iov, count, *sent);
+    size_t attempted = 0;
+    for (int i = 0; i < count; i++) attempted += iov[i].iov_len;
+
+    struct msghdr message = {.msg_iov = iov, .msg_iovlen = count};
+    ssize_t bytes_sent;
+    while ((bytes_sent = sendmsg(socket_fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        bytes_sent = 0;
+        break;
+    }
+
+    *blocked = (size_t)bytes_sent < attempted;
+    return iovec_messages_done(sent, bytes_sent, lengths, messages);
+}
+
 void receive_crud_packet(int socket_fd, crud_packet *pkg, parse_mode m) {
     if (m == READ_CONTROL) {
         uint8_t *control = read_n_bytes_from_file(socket_fd, 1);
@@ -195,8 +477,7 @@ void receive_crud_packet(int socket_fd, crud_packet *pkg, parse_mode m) {
         free(control);
     }
 
-    crud_action ack_masked = pkg->action & 0x07;
-    if (ack_masked != GET && ack_masked != SET && ack_masked != DEL) {
+    if (!crud_action_is_valid(pkg->action)) {
         free_crud_packet(pkg);
         panic("Illegal request parameter %#x.\n", pkg->action);
     }
@@ -207,35 +488,29 @@ void receive_crud_packet(int socket_fd, crud_packet *pkg, parse_mode m) {
         panic("Couldn't get packet header.\n");
     }
 
-    memcpy(&pkg->key->length, header, sizeof(uint16_t));
-    pkg->key->length = ntohs(pkg->key->length);
-
-    memcpy(&pkg->value->length, header + sizeof(uint16_t), sizeof(pkg->value->length));
-    pkg->value->length = ntohl(pkg->value->length);
-
+    decode_crud_header(pkg, header);
     free(header);
 
-    uint8_t *key = read_n_bytes_from_file(socket_fd, pkg->key->length);
-    uint8_t *value = read_n_bytes_from_file(socket_fd, pkg->value->length);
+    uint8_t *extensions = read_n_bytes_from_file(socket_fd, crud_extension_size(pkg));
+    if (extensions != NULL) {
+        decode_crud_extensions(pkg, extensions);
+        free(extensions);
+    }
 
-    pkg->key->contents = key;
-    pkg->key->contents_are_freeable = key == NULL ? 0 : 1;
-    pkg->value->contents = value;
-    pkg->value->contents_are_freeable = value == NULL ? 0 : 1;
+    bytebuffer_allocate(pkg->key, pkg->key->length);
+    bytebuffer_allocate(pkg->value, pkg->value->length);
+    if (read_n_bytes_into(socket_fd, pkg->key->contents, pkg->key->length) == -1) bytebuffer_reset(pkg->key);
+    if (read_n_bytes_into(socket_fd, pkg->value->contents, pkg->value->length) == -1) bytebuffer_reset(pkg->value);
 
     debug("Got CRUD packet with action %#x\nKey: %.*s\nValue: %.*s\n", pkg->action, pkg->key->length, (char *)pkg->key->contents, pkg->value->length, (char *)pkg->value->contents);
 }
 
+// Präfix, Key und Value gehen zusammen mit einem sendmsg() raus, statt mit einem send() pro Feld
 int send_crud_packet(int socket_fd, crud_packet *pkg) {
-    uint8_t flags = (pkg->reserved << 4) | pkg->action;
-    uint16_t nw_key_length = htons((uint16_t)pkg->key->length);
-    uint32_t nw_value_length = htonl(pkg->value->length);
-
-    if (write_n_bytes_to_file(socket_fd, &flags, sizeof(flags)) < 0 ||
-        write_n_bytes_to_file(socket_fd, (uint8_t *)&nw_key_length, sizeof(nw_key_length)) < 0 ||
-        write_n_bytes_to_file(socket_fd, (uint8_t *)&nw_value_length, sizeof(nw_value_length)) < 0 ||
-        write_n_bytes_to_file(socket_fd, pkg->key->contents, pkg->key->length) < 0 ||
-        write_n_bytes_to_file(socket_fd, pkg->value->contents, pkg->value->length) < 0) {
+    uint8_t prefix[CRUD_MAX_PREFIX_SIZE];
+    struct iovec iov[CRUD_IOVEC_COUNT];
+    int count = crud_packet_iovec(pkg, prefix, iov);
+    if (send_iovec(socket_fd, iov, count) < 0) {
         warn("Failed to send packet.\n");
         return -1;
     }
@@ -246,31 +521,41 @@ int send_crud_packet(int socket_fd, crud_packet *pkg) {
 uint8_t *read_n_bytes_from_file(int fd, uint32_t amount) {
     if (amount == 0) return NULL;
 
-    uint8_t *bytes = calloc(1, amount);
+    // malloc statt calloc, die Bytes werden gleich überschrieben. Nur wenn die Verbindung vorher endet, wird der Rest genullt.
+    uint8_t *bytes = malloc(amount);
     if (bytes == NULL) {
         panic("%s\n", strerror(errno));
     }
 
+    if (read_n_bytes_into(fd, bytes, amount) == -1) {
+        free(bytes);
+        return NULL;
+    }
+    return bytes;
+}
+
+// Wie read_n_bytes_from_file(), nur in Speicher vom Aufrufer. Gibt -1 zurück, wenn read() fehlschlägt.
+int read_n_bytes_into(int fd, uint8_t *bytes, uint32_t amount) {
     int received_bytes = 0;
     uint32_t total_bytes = 0;
 
-    while ((received_bytes = read(fd, bytes + total_bytes, amount - total_bytes)) > 0) {
+    while (total_bytes < amount && (received_bytes = read(fd, bytes + total_bytes, amount - total_bytes)) > 0) {
         total_bytes += received_bytes;
     }
 
     if (received_bytes == -1) {
         warn("%s\n", strerror(errno));
-        free(bytes);
-        return NULL;
+        return -1;
     }
+    if (total_bytes < amount) memset(bytes + total_bytes, 0, amount - total_bytes);
 
-    return bytes;
+    return 0;
 }
 
 int write_n_bytes_to_file(int fd, uint8_t *bytes, uint32_t amount) {
     uint32_t total_bytes_sent = 0;
     while (amount - total_bytes_sent > 0) {
-        ssize_t bytes_sent = send(fd, bytes + total_bytes_sent, amount - total_bytes_sent, 0);
+        ssize_t bytes_sent = send(fd, bytes + total_bytes_sent, amount - total_bytes_sent, MSG_NOSIGNAL);  // geschlossene Gegenseite soll kein SIGPIPE auslösen, sondern nur einen Fehler
         if (bytes_sent < 0) {
             warn("%s\n", strerror(errno));
             return -1;
@@ -290,8 +575,10 @@ char *ip4_to_string(struct in_addr *ip4) {
     return ip4_repr;
 }
 
-int establish_tcp_connection_from_ip4(uint32_t ip4, uint16_t port) {
-    int socket_fd = -1;
+// Fängt an, eine Verbindung zu ip4:port (beide in Network Byte Order) aufzubauen, ohne darauf zu warten.
+// Der Socket ist non-blocking und meldet sich bei epoll mit EPOLLOUT, sobald der Handshake durch ist. Ob er geklappt hat,
+// steht dann in SO_ERROR. Wenn schon das Anfangen fehlschlägt, wird -1 zurückgegeben.
+int start_tcp_connection_from_ip4(uint32_t ip4, uint16_t port) {
     struct sockaddr_in address = {
         .sin_family = AF_INET,
         .sin_addr = {
@@ -301,29 +588,20 @@ int establish_tcp_connection_from_ip4(uint32_t ip4, uint16_t port) {
     };
     memset(&address.sin_zero, 0, sizeof(address.sin_zero));
 
-    char *ip4_repr = ip4_to_string(&address.sin_addr);
-    uint16_t dbg_port = ntohs(port);
-    if ((socket_fd = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
-        free(ip4_repr);
-        panic("%s\n", strerror(errno));
+    int socket_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (socket_fd == -1) {
+        warn("%s\n", strerror(errno));
+        return -1;
     }
 
-    for (size_t i = 0; i < CONNECTION_RETRIES; i++) {
-        if (connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) == 0) break;
-        if (i == CONNECTION_RETRIES - 1) {
-            close(socket_fd);
-            panic("Couldn't establish a connection with %s:%d.\n", ip4_repr, dbg_port);
-        }
-
-        warn("%s. Couldn't establish a connection with %s:%d on try %ld, retrying now.\n", strerror(errno), ip4_repr, dbg_port, i + 1);
-        struct timespec ts = {
-            .tv_sec = CONNECTION_TIMEOUT / 1000,
-            .tv_nsec = (CONNECTION_TIMEOUT % 1000) * 1000000,
-        };
-        nanosleep(&ts, &ts);
+    if (connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) == -1 && errno != EINPROGRESS) {
+        char *ip4_repr = ip4_to_string(&address.sin_addr);
+        warn("%s. Couldn't establish a connection with %s:%d.\n", strerror(errno), ip4_repr, ntohs(port));
+        free(ip4_repr);
+        close(socket_fd);
+        return -1;
     }
 
-    free(ip4_repr);
     return socket_fd;
 }
 
@@ -429,6 +707,11 @@ generic_packet *read_unknown_packet(int fd) {
     generic_packet *wrapper = get_blank_unknown_packet();
 
     uint8_t *control = read_n_bytes_from_file(fd, 1);
+    if (control == NULL) {
+        debug("Connection on socket %d was closed before a packet could be read.\n", fd);
+        free(wrapper);
+        return NULL;
+    }
     protocol_t proto_type = (control[0] & 0x80) >> 7;
 
     switch (proto_type) {
@@ -3,14 +3,37 @@
 
 #include <stdint.h>
 #include <netinet/in.h>
-#include "uthash.h"
+#include <sys/uio.h>
 #include "bytebuffer.h"
 
 #define CRUD_HEADER_SIZE 6
 #define CHORD_PACKET_SIZE 10
 #define MAX_DATA_ACCEPT 512
-#define CONNECTION_RETRIES 5
-#define CONNECTION_TIMEOUT 1000
+// So viele freigegebene CRUD Pakete werden höchstens für get_blank_crud_packet() aufgehoben
+#define CRUD_PACKET_CACHE_SIZE 256
+
+// Bits im reserved-Nibble vom CRUD Kontrollbyte. Ist ein Bit gesetzt, folgt nach dem Header das zugehörige Erweiterungsfeld.
+// Von Clients kommt nur CRUD_FLAG_TTL, die anderen Bits setzen und verstehen nur Peers untereinander.
+#define CRUD_FLAG_REQUEST_ID 0x1
+#define CRUD_REQUEST_ID_SIZE 4
+// Nur in Antworten an andere Peers: der angefragte Peer ist nicht (mehr) für den Key zuständig. Kein Erweiterungsfeld.
+#define CRUD_FLAG_NOT_RESPONSIBLE 0x2
+// Nur bei SET: der Eintrag läuft nach so vielen Sekunden ab. 0 heißt, dass er nicht abläuft.
+#define CRUD_FLAG_TTL 0x4
+#define CRUD_TTL_SIZE 4
+
+// Bits im reserved-Feld vom Chord Kontrollbyte (Bits 2-6). Genauso wie bei CRUD folgt nach dem Body das Erweiterungsfeld.
+// Die Erweiterungsfelder stehen in der Reihenfolge der Bits hintereinander.
+#define CHORD_FLAG_REQUEST_ID 0x1
+#define CHORD_REQUEST_ID_SIZE 4
+#define CHORD_FLAG_RANGE 0x2
+#define CHORD_RANGE_SIZE 4
+
+// Kontrollbyte, Header und alle Erweiterungsfelder zusammen, also alles vor Key und Value
+#define CRUD_MAX_PREFIX_SIZE (1 + CRUD_HEADER_SIZE + CRUD_REQUEST_ID_SIZE + CRUD_TTL_SIZE)
+// So viele iovecs braucht ein CRUD Paket höchstens: Präfix, Key und Value
+#define CRUD_IOVEC_COUNT 3
+#define CHORD_MAX_ENCODED_SIZE (1 + CHORD_PACKET_SIZE + CHORD_REQUEST_ID_SIZE + CHORD_RANGE_SIZE)
 
 typedef enum {
     DEL = 1,
@@ -27,14 +50,24 @@ typedef enum {
 typedef struct {
     unsigned int reserved;
     crud_action action;
+    uint32_t request_id;  // nur gültig, wenn CRUD_FLAG_REQUEST_ID in reserved gesetzt ist
+    uint32_t ttl;  // in Sekunden, nur gültig, wenn CRUD_FLAG_TTL in reserved gesetzt ist
     bytebuffer* key;
     bytebuffer* value;
-    UT_hash_handle hh;
+    unsigned int embedded : 1;  // key und value liegen im selben Block wie das Paket, siehe get_blank_crud_packet()
+    // Nur in Antworten vom Datastore: das Value steht nicht in value->contents, sondern ab value_offset in value_fd.
+    // value->length stimmt trotzdem, und value->owner hält die Datei so lange fest.
+    unsigned int value_in_file : 1;
+    int value_fd;
+    uint64_t value_offset;
 } crud_packet;
 
 typedef struct {
     unsigned int reserved;
     chord_action action;
+    uint32_t request_id;  // nur gültig, wenn CHORD_FLAG_REQUEST_ID in reserved gesetzt ist
+    uint16_t area_start;  // Bereich vom Peer im Body, nur gültig, wenn CHORD_FLAG_RANGE in reserved gesetzt ist
+    uint16_t area_stop;
     uint16_t hash_id;
     uint16_t node_id;
     uint32_t node_ip;
@@ -69,22 +102,42 @@ crud_packet* get_blank_crud_packet();
 crud_packet* initialize_crud_packet_with_values(crud_action a, bytebuffer* key, bytebuffer* value);
 void free_crud_packet(crud_packet* pkg);
 void parse_crud_control(int socket_fd, crud_packet* pkg, uint8_t* control);
+int crud_action_is_valid(crud_action a);
+void decode_crud_header(crud_packet* pkg, uint8_t* header);
+uint32_t crud_extension_size(crud_packet* pkg);
+void decode_crud_extensions(crud_packet* pkg, uint8_t* extensions);
+size_t crud_encoded_size(crud_packet* pkg);
+size_t encode_crud_prefix(crud_packet* pkg, uint8_t* destination);
+void encode_crud_packet(crud_packet* pkg, uint8_t* destination);
+int crud_packet_iovec(crud_packet* pkg, uint8_t* prefix, struct iovec* iov);
 void receive_crud_packet(int socket_fd, crud_packet* pkg, parse_mode m);
 int send_crud_packet(int socket_fd, crud_packet* pkg);
 
 chord_packet* get_blank_chord_packet();
 void parse_chord_control(int socket_fd, chord_packet* pkg, uint8_t* control);
+void decode_chord_body(chord_packet* pkg, uint8_t* contents);
+uint32_t chord_extension_size(chord_packet* pkg);
+void decode_chord_extensions(chord_packet* pkg, uint8_t* extensions);
+size_t encode_chord_packet(chord_packet* pkg, uint8_t* destination);
 void receive_chord_packet(int socket_fd, chord_packet* pkg, parse_mode m);
 int send_chord_packet(int socket_fd, chord_packet* pkg);
+int string_to_uint16(char* src, uint16_t* dest);
 int peer_stores_hashvalue(peer* peer, uint16_t hash_value);
+int parse_peer_address(peer* p, char* id, char* host, char* port);
 peer* setup_ring_neighbours(char* information[]);
 
 uint8_t* read_n_bytes_from_file(int fd, uint32_t amount);
+int read_n_bytes_into(int fd, uint8_t* bytes, uint32_t amount);
 int write_n_bytes_to_file(int fd, uint8_t* bytes, uint32_t amount);
+int iovec_advance(struct iovec** iov, int count, size_t bytes);
+int send_iovec(int socket_fd, struct iovec* iov, int count);
+int iovec_messages_done(size_t* sent, size_t bytes, const size_t* lengths, int messages);
+int send_iovec_messages(int socket_fd, struct iovec* iov, int count, const size_t* lengths, int messages, size_t* sent, int* blocked);
 char* ip4_to_string(struct in_addr* ip4);
-int establish_tcp_connection_from_ip4(uint32_t ip4, uint16_t port);
+int start_tcp_connection_from_ip4(uint32_t ip4, uint16_t port);
 int establish_tcp_connection(char* host, char* port);
 int setup_tcp_listener(char* port);
+generic_packet* get_blank_unknown_packet();
 generic_packet* read_unknown_packet(int fd);
 
 #endif
\ No newline at end of file
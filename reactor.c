@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "reactor.h"
+#include "debug.h"
+
+reactor* reactor_initialize() {
+    reactor* r = calloc(1, sizeof(reactor));
+    if (r == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd == -1) {
+        panic("%s\n", strerror(errno));
+    }
+    r->registered = 0;
+    r->retired = VLA_initialize(REACTOR_MAX_EVENTS, sizeof(reactor_handler*));
+
+    return r;
+}
+
+void reactor_handler_init(reactor_handler* h, int fd, reactor_callback on_event, reactor_destructor on_destroy, void* context) {
+    h->fd = fd;
+    h->events = 0;
+    h->on_event = on_event;
+    h->on_destroy = on_destroy;
+    h->context = context;
+    h->retired = 0;
+}
+
+// Nimmt h in das epoll-Set auf. Kostet unabhängig von der Anzahl registrierter Sockets immer nur einen epoll_ctl() Aufruf.
+int reactor_register(reactor* r, reactor_handler* h, uint32_t events) {
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = h,
+    };
+
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, h->fd, &ev) == -1) {
+        warn("%s\n", strerror(errno));
+        return -1;
+    }
+
+    h->events = events;
+    r->registered++;
+    return 0;
+}
+
+int reactor_modify(reactor* r, reactor_handler* h, uint32_t events) {
+    if (h->events == events) return 0;
+
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = h,
+    };
+
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, h->fd, &ev) == -1) {
+        warn("%s\n", strerror(errno));
+        return -1;
+    }
+
+    h->events = events;
+    return 0;
+}
+
+// Entfernt h aus dem epoll-Set. Der Handler wird aber erst am Ende vom aktuellen reactor_run_once() über on_destroy
+// freigegeben, weil im gleichen Batch von epoll_wait() noch Events für ihn stehen können (zB. wenn ein anderer Handler
+// diese Verbindung geschlossen hat). Ohne den Aufschub hätte man dann einen use-after-free.
+void reactor_retire(reactor* r, reactor_handler* h) {
+    if (h->retired) return;
+
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, h->fd, NULL) == -1) {
+        warn("%s\n", strerror(errno));
+    }
+
+    h->retired = 1;
+    r->registered--;
+    VLA_insert(r->retired, &h, 1);
+}
+
+static void reactor_handle_timer(reactor_handler* h, uint32_t events) {
+    reactor_timer* t = h->context;
+
+    // Der Zähler muss gelesen werden, sonst bleibt das timerfd lesbar und weckt epoll sofort wieder auf.
+    // Verpasste Ticks werden nicht nachgeholt, der Callback läuft nur einmal.
+    uint64_t expirations;
+    if (read(h->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+    t->on_tick(t->tick_context);
+}
+
+static void reactor_destroy_timer(reactor_handler* h) {
+    close(h->fd);
+    free(h->context);
+}
+
+// Ruft on_tick(context) alle interval Millisekunden aus der Event Loop heraus auf.
+reactor_timer* reactor_start_timer(reactor* r, int interval, void (*on_tick)(void* context), void* context) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        panic("%s\n", strerror(errno));
+    }
+
+    struct itimerspec spec = {
+        .it_interval = {
+            .tv_sec = interval / 1000,
+            .tv_nsec = (interval % 1000) * 1000000,
+        },
+        .it_value = {
+            .tv_sec = interval / 1000,
+            .tv_nsec = (interval % 1000) * 1000000,
+        },
+    };
+    if (timerfd_settime(fd, 0, &spec, NULL) == -1) {
+        panic("%s\n", strerror(errno));
+    }
+
+    reactor_timer* t = malloc(sizeof(reactor_timer));
+    if (t == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    reactor_handler_init(&t->handler, fd, reactor_handle_timer, reactor_destroy_timer, t);
+    t->on_tick = on_tick;
+    t->tick_context = context;
+    if (reactor_register(r, &t->handler, EPOLLIN) == -1) {
+        panic("Couldn't watch timer.\n");
+    }
+
+    return t;
+}
+
+void reactor_stop_timer(reactor* r, reactor_timer* t) {
+    reactor_retire(r, &t->handler);
+}
+
+// Wartet höchstens timeout Millisekunden (-1 = unendlich) auf Events und ruft für jeden bereiten File Descriptor
+// den zugehörigen Handler auf. Gibt die Anzahl an bearbeiteten Events zurück, oder -1 bei einem Fehler.
+int reactor_run_once(reactor* r, int timeout) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    int event_count = epoll_wait(r->epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+
+    if (event_count == -1) {
+        if (errno != EINTR) warn("%s\n", strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < event_count; i++) {
+        reactor_handler* h = events[i].data.ptr;
+        if (h->retired) continue;
+        h->on_event(h, events[i].events);
+    }
+
+    // on_destroy kann selbst wieder Handler entfernen, deswegen wird die Länge in jedem Durchlauf neu gelesen
+    for (size_t i = 0; i < r->retired->memory->length / r->retired->item_size; i++) {
+        reactor_handler* h = ((reactor_handler**)r->retired->memory->contents)[i];
+        if (h->on_destroy != NULL) h->on_destroy(h);
+    }
+    r->retired->memory->length = 0;
+
+    return event_count;
+}
+
+void reactor_destruct(reactor* r) {
+    for (size_t i = 0; i < r->retired->memory->length / r->retired->item_size; i++) {
+        reactor_handler* h = ((reactor_handler**)r->retired->memory->contents)[i];
+        if (h->on_destroy != NULL) h->on_destroy(h);
+    }
+    close(r->epoll_fd);
+    VLA_cleanup(r->retired, NULL);
+    free(r);
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "VLA.h"
+
+#define REACTOR_MAX_EVENTS 64
+
+typedef struct reactor_handler reactor_handler;
+typedef void (*reactor_callback)(reactor_handler* h, uint32_t events);
+typedef void (*reactor_destructor)(reactor_handler* h);
+
+// Wird pro File Descriptor im epoll-Set registriert. Der Pointer auf das struct landet direkt
+// in epoll_event.data.ptr, damit man beim Aufwachen ohne Suche beim richtigen Handler ankommt.
+// Am besten als erstes Feld in ein größeres struct einbetten, dann kann man im Callback einfach zurückcasten.
+struct reactor_handler {
+    int fd;
+    uint32_t events;
+    reactor_callback on_event;
+    reactor_destructor on_destroy;
+    void* context;
+    uint retired : 1;
+};
+
+// Periodischer Timer über ein timerfd, der wie jeder andere File Descriptor in der Event Loop hängt.
+// So braucht die Event Loop keine eigene Zeitverwaltung, und epoll_wait() kann weiter ohne Timeout schlafen.
+typedef struct {
+    reactor_handler handler;
+    void (*on_tick)(void* context);
+    void* tick_context;
+} reactor_timer;
+
+typedef struct {
+    int epoll_fd;
+    size_t registered;
+    VLA* retired;  // Handler, die während eines Durchlaufs entfernt wurden und erst danach freigegeben werden dürfen
+} reactor;
+
+reactor* reactor_initialize();
+void reactor_handler_init(reactor_handler* h, int fd, reactor_callback on_event, reactor_destructor on_destroy, void* context);
+int reactor_register(reactor* r, reactor_handler* h, uint32_t events);
+int reactor_modify(reactor* r, reactor_handler* h, uint32_t events);
+void reactor_retire(reactor* r, reactor_handler* h);
+reactor_timer* reactor_start_timer(reactor* r, int interval, void (*on_tick)(void* context), void* context);
+void reactor_stop_timer(reactor* r, reactor_timer* t);
+int reactor_run_once(reactor* r, int timeout);
+void reactor_destruct(reactor* r);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <string.h>
+#include "ring.h"
+#include "hash.h"
+#include "VLA.h"
+#include "debug.h"
+
+// Position vom index-ten virtuellen Knoten eines Peers. Der erste liegt auf der ID vom Peer selbst,
+// damit verhält sich ein Peer mit nur einem virtuellen Knoten genauso wie ohne.
+// Alle anderen werden aus ID und Index gehasht, so kommt jeder Peer ohne Absprache auf die gleichen Positionen.
+uint16_t virtual_node_id(uint16_t node_id, int index) {
+    if (index == 0) return node_id;
+
+    uint8_t seed[4] = {node_id >> 8, node_id & 0xff, index >> 8, index & 0xff};
+    return hash_key_to_ring(seed, sizeof(seed));
+}
+
+static int compare_virtual_nodes(const void* a, const void* b) {
+    const virtual_node* x = a;
+    const virtual_node* y = b;
+
+    if (x->id != y->id) return x->id < y->id ? -1 : 1;
+    // Zwei Punkte auf der gleichen Position: bekannter Besitzer vor unbekanntem, sonst gewinnt die kleinere Peer ID.
+    // Das muss auf allen Peers gleich entschieden werden, deswegen hängt es nicht von der Reihenfolge in der Datei ab.
+    if ((x->owner == NULL) != (y->owner == NULL)) return x->owner == NULL ? 1 : -1;
+    if (x->owner == NULL || x->owner->node_id == y->owner->node_id) return 0;
+    return x->owner->node_id < y->owner->node_id ? -1 : 1;
+}
+
+// Sortiert die gesammelten Punkte und behält von mehreren auf der gleichen Position nur den ersten
+static void ring_layout_finish(ring_layout* layout, VLA* collected) {
+    virtual_node* vnodes = (virtual_node*)collected->memory->contents;
+    size_t count = collected->memory->length / collected->item_size;
+    qsort(vnodes, count, sizeof(virtual_node), compare_virtual_nodes);
+
+    layout->vnodes = malloc(count * sizeof(virtual_node));
+    if (layout->vnodes == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+
+    layout->vnode_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (layout->vnode_count > 0 && layout->vnodes[layout->vnode_count - 1].id == vnodes[i].id) {
+            debug("Virtual node %#x collides with another one, ignoring it.\n", vnodes[i].id);
+            continue;
+        }
+        layout->vnodes[layout->vnode_count++] = vnodes[i];
+    }
+
+    VLA_cleanup(collected, NULL);
+}
+
+static peer* ring_allocate_members(ring_layout* layout, size_t count) {
+    layout->members = calloc(count, sizeof(peer));
+    if (layout->members == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    layout->member_count = count;
+    return layout->members;
+}
+
+// Aufteilung aus den Kommandozeilenargumenten: Vom Vorgänger ist nur bekannt, wo sein Bereich endet.
+// Alles zwischen Nachfolger und Vorgänger bleibt unbekannt und muss nachgeschlagen werden.
+void ring_layout_from_neighbours(ring_layout* layout, peer* nodes) {
+    peer* members = ring_allocate_members(layout, 2);
+    members[0] = nodes[0];
+    members[1] = nodes[2];
+    layout->self = &members[0];
+
+    VLA* collected = VLA_initialize(3, sizeof(virtual_node));
+    VLA_insert(collected, &(virtual_node){.id = nodes[0].node_id, .owner = &members[0]}, 1);
+    VLA_insert(collected, &(virtual_node){.id = nodes[1].node_id, .owner = NULL}, 1);
+    VLA_insert(collected, &(virtual_node){.id = nodes[2].node_id, .owner = &members[1]}, 1);
+    ring_layout_finish(layout, collected);
+}
+
+// Liest alle Peers aus der Datei path, eine Zeile pro Peer: "<ID> <Host> <Port> [<Virtuelle Knoten>]".
+// Leere Zeilen und Zeilen, die mit # anfangen, werden übersprungen. Ein Peer mit doppelt so viel Kapazität
+// bekommt einfach doppelt so viele virtuelle Knoten und damit ungefähr doppelt so viele Keys.
+// Alle Peers müssen die gleiche Datei benutzen, sonst sind sie sich nicht einig, wem welcher Bereich gehört.
+void ring_layout_from_file(ring_layout* layout, char* path, uint16_t self_id) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        panic("Couldn't open member file %s: %s\n", path, strerror(errno));
+    }
+
+    VLA* parsed = VLA_initialize(8, sizeof(peer));
+    VLA* weights = VLA_initialize(8, sizeof(int));
+    char* line = NULL;
+    size_t line_capacity = 0;
+    int line_number = 0;
+
+    while (getline(&line, &line_capacity, file) != -1) {
+        line_number++;
+        char* save = NULL;
+        char* id = strtok_r(line, " \t\n", &save);
+        if (id == NULL || id[0] == '#') continue;
+
+        char* host = strtok_r(NULL, " \t\n", &save);
+        char* port = strtok_r(NULL, " \t\n", &save);
+        char* weight_string = strtok_r(NULL, " \t\n", &save);
+        if (host == NULL || port == NULL) {
+            panic("Line %d in member file %s is incomplete.\n", line_number, path);
+        }
+
+        peer member;
+        memset(&member, 0, sizeof(member));
+        if (parse_peer_address(&member, id, host, port) < 0) {
+            panic("Couldn't resolve %s:%s from member file %s.\n", host, port, path);
+        }
+
+        uint16_t weight = DEFAULT_VIRTUAL_NODES;
+        if (weight_string != NULL && (!string_to_uint16(weight_string, &weight) || weight == 0 || weight > MAX_VIRTUAL_NODES)) {
+            panic("Line %d in member file %s: the number of virtual nodes must be between 1 and %d.\n", line_number, path, MAX_VIRTUAL_NODES);
+        }
+
+        int vnodes = weight;
+        VLA_insert(parsed, &member, 1);
+        VLA_insert(weights, &vnodes, 1);
+    }
+    free(line);
+    fclose(file);
+
+    size_t count = parsed->memory->length / parsed->item_size;
+    peer* members = ring_allocate_members(layout, count);
+    memcpy(members, parsed->memory->contents, count * sizeof(peer));
+    int* vnode_counts = (int*)weights->memory->contents;
+
+    layout->self = NULL;
+    VLA* collected = VLA_initialize(count * DEFAULT_VIRTUAL_NODES, sizeof(virtual_node));
+    for (size_t i = 0; i < count; i++) {
+        if (members[i].node_id == self_id) layout->self = &members[i];
+        for (int v = 0; v < vnode_counts[i]; v++) {
+            VLA_insert(collected, &(virtual_node){.id = virtual_node_id(members[i].node_id, v), .owner = &members[i]}, 1);
+        }
+    }
+    if (layout->self == NULL) {
+        panic("Node %u is missing from member file %s.\n", self_id, path);
+    }
+
+    ring_layout_finish(layout, collected);
+    VLA_cleanup(parsed, NULL);
+    VLA_cleanup(weights, NULL);
+}
+
+// Index vom ersten Punkt mit id >= hash_value. Hinter dem letzten Punkt geht es beim ersten weiter.
+static size_t ring_successor_index(ring_layout* layout, uint16_t hash_value) {
+    size_t low = 0, high = layout->vnode_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (layout->vnodes[middle].id < hash_value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low == layout->vnode_count ? 0 : low;
+}
+
+// Sucht den Peer, der für hash_value zuständig ist, und den zusammenhängenden Bereich, in dem hash_value liegt.
+// Gibt NULL zurück, wenn das ohne Lookup nicht bekannt ist.
+peer* ring_find_owner(ring_layout* layout, uint16_t hash_value, uint16_t* area_start, uint16_t* area_stop) {
+    size_t index = ring_successor_index(layout, hash_value);
+    virtual_node* owner = &layout->vnodes[index];
+    if (owner->owner == NULL) return NULL;
+
+    virtual_node* previous = &layout->vnodes[index == 0 ? layout->vnode_count - 1 : index - 1];
+    if (area_start != NULL) *area_start = previous->id + 1;
+    if (area_stop != NULL) *area_stop = owner->id;
+    return owner->owner;
+}
+
+// Verallgemeinerung von peer_stores_hashvalue() auf alle Bereiche, die dieser Peer besitzt
+int ring_owns_hashvalue(ring_layout* layout, uint16_t hash_value) {
+    return ring_find_owner(layout, hash_value, NULL, NULL) == layout->self;
+}
+
+// Anzahl der Hash-Werte, für die dieser Peer zuständig ist (von 65536)
+uint32_t ring_owned_share(ring_layout* layout) {
+    uint32_t share = 0;
+    for (size_t i = 0; i < layout->vnode_count; i++) {
+        if (layout->vnodes[i].owner != layout->self) continue;
+        uint16_t previous = layout->vnodes[i == 0 ? layout->vnode_count - 1 : i - 1].id;
+        share += layout->vnode_count == 1 ? 0x10000 : (uint16_t)(layout->vnodes[i].id - previous);
+    }
+    return share;
+}
+
+void ring_layout_destruct(ring_layout* layout) {
+    free(layout->vnodes);
+    free(layout->members);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// So viele virtuelle Knoten bekommt ein Peer in der Mitgliederdatei, wenn dort kein Gewicht steht.
+// Mit ein paar hundert Punkten pro Peer weicht der Anteil am Ring nur noch um wenige Prozent ab.
+#define DEFAULT_VIRTUAL_NODES 128
+#define MAX_VIRTUAL_NODES 4096
+
+// Ein Punkt im Ring. Der Besitzer ist für alle Hash-Werte nach dem vorherigen Punkt bis einschließlich id zuständig.
+typedef struct {
+    uint16_t id;
+    peer* owner;  // NULL, wenn nur bekannt ist, dass hier ein Bereich endet, aber nicht, wem er gehört
+} virtual_node;
+
+// Alles, was ein Peer über die Aufteilung vom Ring weiß, ohne nachschlagen zu müssen.
+// Ohne Mitgliederdatei sind das nur der eigene Bereich und der vom Nachfolger, mit ihr der ganze Ring.
+typedef struct {
+    virtual_node* vnodes;  // nach id sortiert, jede id kommt nur einmal vor
+    size_t vnode_count;
+    peer* members;  // physische Peers, auf die die virtuellen Knoten zeigen
+    size_t member_count;
+    peer* self;
+} ring_layout;
+
+uint16_t virtual_node_id(uint16_t node_id, int index);
+void ring_layout_from_neighbours(ring_layout* layout, peer* nodes);
+void ring_layout_from_file(ring_layout* layout, char* path, uint16_t self_id);
+peer* ring_find_owner(ring_layout* layout, uint16_t hash_value, uint16_t* area_start, uint16_t* area_stop);
+int ring_owns_hashvalue(ring_layout* layout, uint16_t hash_value);
+uint32_t ring_owned_share(ring_layout* layout);
+void ring_layout_destruct(ring_layout* layout);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include <string.h>
+#include "routecache.h"
+#include "debug.h"
+
+void route_cache_initialize(route_cache* rc) {
+    rc->count = 0;
+}
+
+// Index vom ersten Eintrag mit area_start > hash_value
+static size_t route_cache_upper_bound(route_cache* rc, uint16_t hash_value) {
+    size_t low = 0, high = rc->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (rc->entries[middle].area_start <= hash_value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Gibt den Peer zurück, der laut Cache für hash_value zuständig ist, oder NULL, wenn der Bereich unbekannt ist.
+peer* route_cache_find(route_cache* rc, uint16_t hash_value) {
+    size_t index = route_cache_upper_bound(rc, hash_value);
+    if (index == 0) return NULL;
+
+    peer* candidate = &rc->entries[index - 1];
+    return hash_value <= candidate->area_stop ? candidate : NULL;
+}
+
+static void route_cache_remove(route_cache* rc, size_t index) {
+    memmove(&rc->entries[index], &rc->entries[index + 1], (rc->count - index - 1) * sizeof(peer));
+    rc->count--;
+}
+
+// Fügt den Bereich [area_start, area_stop] ohne Überlauf ein. Einträge, die sich damit überschneiden, sind veraltet
+// (zB. weil ein Peer dazugekommen ist) und fliegen raus.
+static void route_cache_insert_linear(route_cache* rc, peer* entry) {
+    size_t index = 0;
+    while (index < rc->count) {
+        peer* current = &rc->entries[index];
+        if (current->area_start <= entry->area_stop && current->area_stop >= entry->area_start) {
+            route_cache_remove(rc, index);
+        } else {
+            index++;
+        }
+    }
+
+    // Der Cache ist nur eine Abkürzung, im schlimmsten Fall wird eben wieder ein Lookup gemacht
+    if (rc->count == ROUTE_CACHE_CAPACITY) {
+        debug("Route cache is full, dropping all %zu entries.\n", rc->count);
+        rc->count = 0;
+    }
+
+    index = route_cache_upper_bound(rc, entry->area_start);
+    memmove(&rc->entries[index + 1], &rc->entries[index], (rc->count - index) * sizeof(peer));
+    rc->entries[index] = *entry;
+    rc->count++;
+}
+
+void route_cache_insert(route_cache* rc, uint16_t area_start, uint16_t area_stop, uint16_t node_id, uint32_t node_ip, uint16_t node_port) {
+    peer entry = {
+        .area_start = area_start,
+        .area_stop = area_stop,
+        .node_ip = node_ip,
+        .node_port = node_port,
+        .node_id = node_id,
+    };
+
+    if (area_start <= area_stop) {
+        route_cache_insert_linear(rc, &entry);
+        return;
+    }
+
+    // Bereich geht über 0 hinweg -> als zwei Einträge speichern, damit die Suche eine einfache Binärsuche bleibt
+    entry.area_stop = UINT16_MAX;
+    route_cache_insert_linear(rc, &entry);
+    entry.area_start = 0;
+    entry.area_stop = area_stop;
+    route_cache_insert_linear(rc, &entry);
+}
+
+// Vergisst alle Bereiche von node_ip:node_port, zB. weil eine weitergeleitete Anfrage dort fehlgeschlagen ist
+void route_cache_invalidate(route_cache* rc, uint32_t node_ip, uint16_t node_port) {
+    size_t index = 0;
+    while (index < rc->count) {
+        peer* current = &rc->entries[index];
+        if (current->node_ip == node_ip && current->node_port == node_port) {
+            route_cache_remove(rc, index);
+        } else {
+            index++;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef ROUTECACHE_H
+#define ROUTECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// Bei N Peers gibt es höchstens N + 1 Bereiche (der über 0 hinweg wird geteilt), das reicht für ziemlich große Ringe.
+#define ROUTE_CACHE_CAPACITY 256
+
+// Merkt sich, welcher Peer für welchen Bereich zuständig ist, so wie es in den REPLYs stand.
+// Die Einträge sind nach area_start sortiert und überlappen sich nicht, Bereiche über 0 hinweg werden beim Einfügen geteilt.
+typedef struct {
+    peer entries[ROUTE_CACHE_CAPACITY];
+    size_t count;
+} route_cache;
+
+void route_cache_initialize(route_cache* rc);
+peer* route_cache_find(route_cache* rc, uint16_t hash_value);
+void route_cache_insert(route_cache* rc, uint16_t area_start, uint16_t area_stop, uint16_t node_id, uint32_t node_ip, uint16_t node_port);
+void route_cache_invalidate(route_cache* rc, uint32_t node_ip, uint16_t node_port);
+
+#endif
\ No newline at end of file
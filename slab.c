@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "slab.h"
+#include "debug.h"
+
+#define SLAB_HEADER_SIZE ((sizeof(slab_page) + 15) & ~(size_t)15)
+#define EXTENT_ALIGNMENT 4096
+
+static size_t round_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void slab_initialize(slab_allocator* a) {
+    memset(a, 0, sizeof(slab_allocator));
+
+    size_t size = SLAB_MIN_OBJECT;
+    while (a->class_count < SLAB_MAX_CLASSES) {
+        slab_class* c = &a->classes[a->class_count++];
+        c->object_size = size;
+        c->objects_per_page = (SLAB_PAGE_SIZE - SLAB_HEADER_SIZE) / size;
+        if (size == SLAB_MAX_OBJECT) break;
+
+        size_t next = round_up((size_t)(size * SLAB_GROWTH_FACTOR), 8);
+        size = next > SLAB_MAX_OBJECT ? SLAB_MAX_OBJECT : next;
+    }
+
+    int class_index = 0;
+    for (size_t i = 0; i <= SLAB_MAX_OBJECT / 8; i++) {
+        while (a->classes[class_index].object_size < i * 8) class_index++;
+        a->class_for_size[i] = class_index;
+    }
+}
+
+static void slab_unlink(slab_class* c, slab_page* page) {
+    if (page->prev != NULL) {
+        page->prev->next = page->next;
+    } else {
+        c->partial = page->next;
+    }
+    if (page->next != NULL) page->next->prev = page->prev;
+    page->prev = page->next = NULL;
+    page->in_partial = 0;
+}
+
+static void slab_link(slab_class* c, slab_page* page) {
+    page->prev = NULL;
+    page->next = c->partial;
+    if (c->partial != NULL) c->partial->prev = page;
+    c->partial = page;
+    page->in_partial = 1;
+}
+
+static slab_page* slab_new_page(slab_allocator* a, slab_class* c) {
+    slab_page* page = NULL;
+    int error = posix_memalign((void**)&page, SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+    if (error != 0) {
+        panic("%s\n", strerror(error));
+    }
+    memset(page, 0, sizeof(slab_page));
+    page->owner = c;
+    slab_link(c, page);
+
+    c->pages++;
+    a->slab_bytes += SLAB_PAGE_SIZE;
+    return page;
+}
+
+// Gibt Speicher für size Bytes zurück, oder NULL bei size == 0. Die Größe muss bei slab_free() wieder angegeben werden,
+// deswegen brauchen die Objekte selbst keinen Header.
+void* slab_alloc(slab_allocator* a, size_t size) {
+    if (size == 0) return NULL;
+
+    a->requested_bytes += size;
+    a->objects++;
+
+    if (size > SLAB_MAX_OBJECT) {
+        size_t length = round_up(size, EXTENT_ALIGNMENT);
+        void* extent = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (extent == MAP_FAILED) {
+            panic("%s\n", strerror(errno));
+        }
+        a->extent_bytes += length;
+        return extent;
+    }
+
+    slab_class* c = &a->classes[a->class_for_size[round_up(size, 8) / 8]];
+    slab_page* page = c->partial != NULL ? c->partial : slab_new_page(a, c);
+
+    void* object;
+    if (page->free_list != NULL) {
+        object = page->free_list;
+        memcpy(&page->free_list, object, sizeof(void*));
+    } else {
+        object = (uint8_t*)page + SLAB_HEADER_SIZE + (size_t)page->carved * c->object_size;
+        page->carved++;
+    }
+    page->live++;
+
+    if (page->free_list == NULL && page->carved == c->objects_per_page) slab_unlink(c, page);
+    return object;
+}
+
+// Gibt ein Objekt zurück an seine Seite. Ist die Seite danach leer und gibt es in der Klasse noch andere Seiten
+// mit freiem Platz, geht die ganze Seite zurück ans System. So bleiben nach vielen DELs keine halb leeren Seiten übrig,
+// und eine einzelne leere Seite pro Klasse verhindert, dass bei SET/DEL im Wechsel ständig Seiten geholt und freigegeben werden.
+void slab_free(slab_allocator* a, void* object, size_t size) {
+    if (object == NULL) return;
+
+    a->requested_bytes -= size;
+    a->objects--;
+
+    if (size > SLAB_MAX_OBJECT) {
+        size_t length = round_up(size, EXTENT_ALIGNMENT);
+        munmap(object, length);
+        a->extent_bytes -= length;
+        return;
+    }
+
+    slab_page* page = (slab_page*)((uintptr_t)object & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+    slab_class* c = page->owner;
+
+    memcpy(object, &page->free_list, sizeof(void*));
+    page->free_list = object;
+    page->live--;
+
+    if (!page->in_partial) slab_link(c, page);
+
+    if (page->live == 0 && (page->prev != NULL || page->next != NULL)) {
+        slab_unlink(c, page);
+        free(page);
+        c->pages--;
+        a->slab_bytes -= SLAB_PAGE_SIZE;
+    }
+}
+
+// Gibt nur die Seiten frei, die noch in einer Liste hängen. Volle Seiten gehören zu Objekten, die der Aufrufer
+// vorher selbst mit slab_free() zurückgeben muss, genauso wie alle Extents.
+void slab_destruct(slab_allocator* a) {
+    for (int i = 0; i < a->class_count; i++) {
+        slab_class* c = &a->classes[i];
+        while (c->partial != NULL) {
+            slab_page* page = c->partial;
+            slab_unlink(c, page);
+            if (page->live > 0) warn("Slab page of class %u still has %u live objects.\n", c->object_size, page->live);
+            free(page);
+            c->pages--;
+            a->slab_bytes -= SLAB_PAGE_SIZE;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Seiten werden an ihrer Größe ausgerichtet, dann findet man von jedem Objekt aus ohne Header die Seite
+#define SLAB_PAGE_SIZE (64 * 1024)
+#define SLAB_MIN_OBJECT 16
+// Größere Objekte bekommen ein eigenes Extent direkt von mmap()
+#define SLAB_MAX_OBJECT 8192
+// Jede Größenklasse ist ungefähr 1.25 mal so groß wie die vorherige, so verschwendet ein Objekt höchstens ein Fünftel
+#define SLAB_GROWTH_FACTOR 1.25
+#define SLAB_MAX_CLASSES 64
+
+struct slab_class;
+
+// Kopf am Anfang jeder Seite. Freie Objekte bilden eine einfach verkettete Liste in sich selbst,
+// Objekte, die noch nie vergeben wurden, werden erst bei Bedarf vom Ende der benutzten Objekte abgeschnitten.
+typedef struct slab_page {
+    struct slab_class* owner;
+    struct slab_page* prev;  // in der Liste der Seiten mit freien Objekten
+    struct slab_page* next;
+    void* free_list;
+    uint32_t live;
+    uint32_t carved;
+    unsigned int in_partial : 1;
+} slab_page;
+
+typedef struct slab_class {
+    uint32_t object_size;
+    uint32_t objects_per_page;
+    slab_page* partial;  // Seiten, in denen noch mindestens ein Objekt frei ist
+    size_t pages;
+} slab_class;
+
+typedef struct {
+    slab_class classes[SLAB_MAX_CLASSES];
+    int class_count;
+    uint8_t class_for_size[SLAB_MAX_OBJECT / 8 + 1];  // Index = aufgerundete Größe / 8
+    size_t requested_bytes;
+    size_t slab_bytes;
+    size_t extent_bytes;
+    size_t objects;
+} slab_allocator;
+
+void slab_initialize(slab_allocator* a);
+void* slab_alloc(slab_allocator* a, size_t size);
+void slab_free(slab_allocator* a, void* object, size_t size);
+void slab_destruct(slab_allocator* a);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "appendlog.h"
+#include "debug.h"
+
+static inline uint64_t align8(uint64_t value) {
+    return (value + 7) & ~(uint64_t)7;
+}
+
+// Gepuffertes Schreiben ohne stdio, damit snapshot_write() auch in einem Kindprozess nach fork() funktioniert
+typedef struct {
+    int fd;
+    uint8_t* buffer;
+    size_t length;
+    uint64_t offset;  // so viele Bytes wurden insgesamt schon übergeben
+    snapshot_progress* progress;  // kann NULL sein
+} snapshot_writer;
+
+static int writer_flush(snapshot_writer* w) {
+    const uint8_t* bytes = w->buffer;
+    size_t remaining = w->length;
+    while (remaining > 0) {
+        ssize_t written = write(w->fd, bytes, remaining);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        bytes += written;
+        remaining -= written;
+        if (w->progress != NULL) w->progress->written += written;
+    }
+    w->length = 0;
+    return 0;
+}
+
+static int writer_put(snapshot_writer* w, const void* bytes, size_t length) {
+    w->offset += length;
+    while (length > 0) {
+        if (w->length == SNAPSHOT_BUFFER_SIZE && writer_flush(w) == -1) return -1;
+        size_t chunk = SNAPSHOT_BUFFER_SIZE - w->length < length ? SNAPSHOT_BUFFER_SIZE - w->length : length;
+        memcpy(w->buffer + w->length, bytes, chunk);
+        w->length += chunk;
+        bytes = (const uint8_t*)bytes + chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+// Wie writer_put(), holt die Bytes aber ab offset aus der Value-Datei
+static int writer_put_from_file(snapshot_writer* w, value_file* values, uint64_t offset, size_t length) {
+    w->offset += length;
+    while (length > 0) {
+        if (w->length == SNAPSHOT_BUFFER_SIZE && writer_flush(w) == -1) return -1;
+        size_t chunk = SNAPSHOT_BUFFER_SIZE - w->length < length ? SNAPSHOT_BUFFER_SIZE - w->length : length;
+        if (value_file_read(values, offset, w->buffer + w->length, chunk) == -1) return -1;
+        w->length += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+// Größe vom Block im Snapshot, ausgelagerte Values kommen wieder mit hinein
+static size_t snapshot_block_size(const ds_entry* e) {
+    return e->flags & DS_ENTRY_SPILLED ? ds_entry_block_size(e) - sizeof(uint64_t) + e->value_length : ds_entry_block_size(e);
+}
+
+// Füllt bis zur nächsten durch 8 teilbaren Position mit Nullen auf
+static int writer_align(snapshot_writer* w) {
+    static const uint8_t zeros[8] = {0};
+    return writer_put(w, zeros, align8(w->offset) - w->offset);
+}
+
+static int snapshot_write_contents(snapshot_writer* w, swiss_table* t, uint32_t tick, uint32_t ticks_per_second, value_file* values) {
+    swiss_array* a = &t->current;
+    snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.entry_size = sizeof(ds_entry);
+    header.hash_check = swiss_hash((const uint8_t*)"", 0);
+    header.created = time(NULL);
+    header.capacity = a->capacity;
+    header.size = a->size;
+    header.tombstones = a->tombstones;
+    header.ctrl_offset = align8(sizeof(snapshot_header));
+    header.slots_offset = align8(header.ctrl_offset + a->capacity + SWISS_GROUP_WIDTH);
+    header.data_offset = header.slots_offset + a->capacity * sizeof(ds_entry);
+    for (size_t i = 0; i < a->capacity; i++) {
+        if (a->ctrl[i] >= 0 && a->slots[i].block != NULL) header.data_length += align8(snapshot_block_size(&a->slots[i]));
+    }
+    if (w->progress != NULL) w->progress->total = header.data_offset + header.data_length;
+
+    if (writer_put(w, &header, sizeof(header)) == -1 || writer_align(w) == -1) return -1;
+    if (writer_put(w, a->ctrl, a->capacity + SWISS_GROUP_WIDTH) == -1 || writer_align(w) == -1) return -1;
+
+    // Slots mit Offsets statt Pointern. Leere Slots werden genullt, damit kein alter Speicherinhalt in der Datei landet.
+    uint64_t data_position = header.data_offset;
+    for (size_t i = 0; i < a->capacity; i++) {
+        ds_entry slot;
+        memset(&slot, 0, sizeof(slot));
+        if (a->ctrl[i] >= 0) {
+            slot = a->slots[i];
+            slot.flags &= ~(DS_ENTRY_REFERENCED | DS_ENTRY_MAPPED | DS_ENTRY_SPILLED | DS_ENTRY_SHARED);
+            if (slot.block != NULL) {
+                slot.block = (uint8_t*)(uintptr_t)data_position;
+                data_position += align8(snapshot_block_size(&a->slots[i]));
+            }
+        }
+        if (writer_put(w, &slot, sizeof(slot)) == -1) return -1;
+    }
+
+    // Blöcke in der gleichen Reihenfolge. Ablaufzeiten werden von Ticks in Unixzeit umgerechnet, die Pointer vom Timer genullt.
+    for (size_t i = 0; i < a->capacity; i++) {
+        ds_entry* e = &a->slots[i];
+        if (a->ctrl[i] < 0 || e->block == NULL) continue;
+
+        size_t skip = 0;
+        ds_expiry* expiry = ds_entry_expiry(e);
+        if (expiry != NULL) {
+            int32_t remaining = (int32_t)(expiry->timer.deadline - tick);
+            ds_expiry converted;
+            memset(&converted, 0, sizeof(converted));
+            converted.hash = expiry->hash;
+            converted.timer.deadline = header.created + (remaining > 0 ? (remaining + ticks_per_second - 1) / ticks_per_second : 0);
+            if (writer_put(w, &converted, sizeof(converted)) == -1) return -1;
+            skip = sizeof(ds_expiry);
+        }
+        if (e->flags & DS_ENTRY_SPILLED) {
+            if (writer_put(w, e->block + skip, ds_entry_block_size(e) - skip - sizeof(uint64_t)) == -1) return -1;
+            if (values == NULL || writer_put_from_file(w, values, ds_entry_spilled_offset(e), e->value_length) == -1) return -1;
+        } else if (writer_put(w, e->block + skip, ds_entry_block_size(e) - skip) == -1) {
+            return -1;
+        }
+        if (writer_align(w) == -1) return -1;
+    }
+
+    return writer_flush(w);
+}
+
+// Schreibt den Inhalt von t als Snapshot nach path. Die Datei entsteht erst unter path.tmp und wird, wenn sie komplett
+// auf der Platte ist, atomar umbenannt, ein alter Snapshot bleibt also bis dahin gültig. tick ist die aktuelle Zeit
+// für die Ablaufzeiten in den Einträgen. Während einer Vergrößerung vom Index geht das nicht, der Aufrufer muss abwarten,
+// bis sie fertig ist, oder sie mit swiss_finish_rehash() abschließen. Im Kindprozess geht das nicht, weil dabei debug() und free() aufgerufen werden.
+// Benutzt kein stdio, gibt bei Fehlern nur -1 zurück und lässt errno stehen. Ist progress nicht NULL, wird dort
+// mitgezählt, wie viel schon geschrieben ist. Ausgelagerte Values werden aus values gelesen.
+int snapshot_write(swiss_table* t, const char* path, uint32_t tick, uint32_t ticks_per_second, value_file* values, snapshot_progress* progress) {
+    if (t->previous.capacity != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (progress != NULL) {
+        progress->written = 0;
+        progress->total = 0;
+    }
+
+    size_t path_length = strlen(path);
+    char temporary_path[path_length + sizeof(".tmp")];
+    memcpy(temporary_path, path, path_length);
+    memcpy(temporary_path + path_length, ".tmp", sizeof(".tmp"));
+
+    snapshot_writer w = {.fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644), .buffer = malloc(SNAPSHOT_BUFFER_SIZE), .length = 0, .offset = 0, .progress = progress};
+    if (w.fd == -1 || w.buffer == NULL) {
+        int error = errno;
+        if (w.fd != -1) close(w.fd);
+        free(w.buffer);
+        errno = error;
+        return -1;
+    }
+
+    int result = snapshot_write_contents(&w, t, tick, ticks_per_second, values);
+    if (result == 0) result = fdatasync(w.fd);
+    int error = errno;
+    close(w.fd);
+    free(w.buffer);
+
+    if (result == 0) result = rename(temporary_path, path);
+    if (result == 0) {
+        sync_parent_directory(path);
+    } else {
+        error = errno;
+        unlink(temporary_path);
+    }
+    errno = error;
+    return result;
+}
+
+// Mappt den Snapshot unter path und prüft, ob er zu diesem Build passt. Die Seiten werden erst geladen, wenn jemand
+// darauf zugreift. MAP_PRIVATE, damit Ablaufzeiten in den Blöcken geändert werden können, ohne die Datei anzufassen.
+// Gibt 1 zurück, wenn es keinen Snapshot gibt, 0 bei Erfolg und -1, wenn er nicht benutzt werden kann.
+int snapshot_map(const char* path, snapshot_mapping* m) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) return 1;
+        warn("Couldn't open snapshot %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(snapshot_header)) {
+        warn("Snapshot %s is too short.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    m->length = info.st_size;
+    m->base = mmap(NULL, m->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m->base == MAP_FAILED) {
+        warn("Couldn't map snapshot %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Erst wenn capacity und alle Offsets höchstens so groß wie die Datei sind, kann beim Rechnen nichts überlaufen
+    snapshot_header* header = (snapshot_header*)m->base;
+    uint64_t capacity = header->capacity;
+    int valid = memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+                header->version == SNAPSHOT_VERSION &&
+                header->entry_size == sizeof(ds_entry) &&
+                header->hash_check == swiss_hash((const uint8_t*)"", 0) &&
+                capacity >= SWISS_MIN_CAPACITY && capacity <= m->length && (capacity & (capacity - 1)) == 0 &&
+                header->size <= capacity && header->tombstones <= capacity &&
+                header->size + header->tombstones <= capacity - capacity / 8 &&
+                header->ctrl_offset <= m->length && header->slots_offset <= m->length && header->data_offset <= m->length &&
+                header->data_length <= m->length - header->data_offset &&
+                header->ctrl_offset + capacity + SWISS_GROUP_WIDTH <= header->slots_offset &&
+                header->slots_offset + capacity * sizeof(ds_entry) <= header->data_offset;
+    if (!valid) {
+        warn("Snapshot %s doesn't match this build, ignoring it.\n", path);
+        snapshot_unmap(m);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Prüft jeden belegten Slot im Snapshot, bevor ihm jemand glaubt: sein Block muss ganz im Datenbereich liegen,
+// und die Anzahl der belegten und gelöschten Slots muss zum Header passen. Gibt 0 zurück, wenn alles stimmt.
+static int snapshot_check_slots(snapshot_mapping* m, snapshot_header* header) {
+    const int8_t* ctrl = (const int8_t*)(m->base + header->ctrl_offset);
+    const ds_entry* slots = (const ds_entry*)(m->base + header->slots_offset);
+    uint64_t data_end = header->data_offset + header->data_length;
+    uint64_t size = 0;
+    uint64_t tombstones = 0;
+
+    for (uint64_t i = 0; i < header->capacity; i++) {
+        if (ctrl[i] == SWISS_DELETED) tombstones++;
+        if (ctrl[i] < 0) continue;
+        size++;
+
+        // Beim Schreiben werden diese Bits gelöscht, mit SPILLED würde auch die Größe vom Block nicht mehr stimmen
+        const ds_entry* e = &slots[i];
+        if (e->flags & (DS_ENTRY_MAPPED | DS_ENTRY_SPILLED | DS_ENTRY_SHARED)) return -1;
+        uint64_t block_size = ds_entry_block_size(e);
+        uint64_t offset = (uintptr_t)e->block;
+        if (e->block == NULL) {
+            if (block_size != 0) return -1;
+            continue;
+        }
+        if (offset < header->data_offset || offset % sizeof(uint64_t) != 0 || offset > data_end || block_size > data_end - offset) return -1;
+    }
+
+    return size == header->size && tombstones == header->tombstones ? 0 : -1;
+}
+
+// Übernimmt den Index aus dem Snapshot nach t und biegt die Blöcke auf das Mapping um. Die Blöcke selbst werden
+// dabei nicht angefasst, die Values kommen erst bei der ersten Anfrage von der Platte.
+// Passt ein Slot nicht zum Snapshot, bleibt t unverändert, das Mapping wird freigegeben und es gibt -1.
+int snapshot_restore(snapshot_mapping* m, swiss_table* t) {
+    snapshot_header* header = (snapshot_header*)m->base;
+    if (snapshot_check_slots(m, header) == -1) {
+        warn("Snapshot is corrupt, ignoring it.\n");
+        snapshot_unmap(m);
+        return -1;
+    }
+
+    swiss_restore(t, (const int8_t*)(m->base + header->ctrl_offset), (const ds_entry*)(m->base + header->slots_offset), header->capacity, header->size, header->tombstones);
+
+    swiss_array* a = &t->current;
+    for (size_t i = 0; i < a->capacity; i++) {
+        if (a->ctrl[i] < 0 || a->slots[i].block == NULL) continue;
+        a->slots[i].block = m->base + (uintptr_t)a->slots[i].block;
+        a->slots[i].flags |= DS_ENTRY_MAPPED;
+    }
+    return 0;
+}
+
+void snapshot_unmap(snapshot_mapping* m) {
+    munmap(m->base, m->length);
+    m->base = NULL;
+    m->length = 0;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "swisstable.h"
+#include "valuefile.h"
+
+#define SNAPSHOT_MAGIC "CHRDSNAP"
+// Version 2: Startposition im Index aus dem ganzen Hash, die Slots von Version 1 stehen an anderen Stellen
+#define SNAPSHOT_VERSION 2
+// Puffer, mit dem snapshot_write() schreibt
+#define SNAPSHOT_BUFFER_SIZE (256 * 1024)
+
+// Am Anfang jeder Snapshot-Datei. Danach kommen die Kontrollbytes, die Slots und zuletzt alle Blöcke, jeweils auf
+// 8 Bytes ausgerichtet. Die Datei ist genau das Array current vom Index, nur steht in block der Offset vom Block
+// in der Datei statt einem Pointer. Mit ds_expiry im Block steht in timer.deadline die Unixzeit, zu der er abläuft.
+// Ausgelagerte Values stehen wieder direkt im Block, die Value-Datei überlebt keinen Neustart.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;  // sizeof(ds_entry), Builds mit anderem Layout lehnen die Datei ab
+    uint32_t hash_check;  // swiss_hash() vom leeren Key, damit eine andere Hashfunktion auffällt
+    uint32_t reserved;
+    uint64_t created;  // Unixzeit beim Schreiben
+    uint64_t capacity;
+    uint64_t size;
+    uint64_t tombstones;
+    uint64_t ctrl_offset;
+    uint64_t slots_offset;
+    uint64_t data_offset;
+    uint64_t data_length;
+} snapshot_header;
+
+typedef struct {
+    uint8_t* base;
+    size_t length;
+} snapshot_mapping;
+
+// Fortschritt von snapshot_write(). Liegt bei Snapshots im Hintergrund in geteiltem Speicher, damit der Peer
+// sieht, wie weit der Kindprozess ist.
+typedef struct {
+    volatile uint64_t written;  // schon an die Datei übergebene Bytes
+    volatile uint64_t total;  // Größe der fertigen Datei
+    volatile uint64_t copied_bytes;  // Private_Dirty vom Kindprozess am Ende, also was fork() doch kopieren musste
+} snapshot_progress;
+
+int snapshot_write(swiss_table* t, const char* path, uint32_t tick, uint32_t ticks_per_second, value_file* values, snapshot_progress* progress);
+int snapshot_map(const char* path, snapshot_mapping* m);
+int snapshot_restore(snapshot_mapping* m, swiss_table* t);
+void snapshot_unmap(snapshot_mapping* m);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,383 @@
+#include <errno.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "swisstable.h"
+#include "hash.h"
+#include "debug.h"
+
+// Eigener Seed, damit der Index nicht mit der Position im Ring zusammenhängt. Ein Peer besitzt nur bestimmte Bereiche
+// vom Ring, die oberen Bits von hash_key() sind bei seinen Keys also alles andere als gleichverteilt.
+#define SWISS_HASH_SEED 0x5f3759df
+
+uint32_t swiss_hash(const uint8_t* key, size_t length) {
+    return xxh32(key, length, SWISS_HASH_SEED);
+}
+
+// Die Startposition kommt aus allen 32 Bits vom Hash, noch einmal durchgemischt. Nur die 25 Bits über h2 würden ab
+// 2^25 Slots nicht mehr reichen, das Sondieren finge dann nur noch in einem Teil der Gruppen an.
+static inline size_t swiss_h1(uint32_t hash) {
+    uint64_t mixed = hash * 0x9e3779b97f4a7c15ull;
+    return (size_t)(mixed ^ (mixed >> 32));
+}
+
+static inline int8_t swiss_h2(uint32_t hash) {
+    return hash & 0x7f;
+}
+
+// Bitmaske mit einem Bit pro Kontrollbyte in der Gruppe, das gleich value ist
+static inline uint32_t swiss_match(const int8_t* group, int8_t value) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+        if (group[i] == value) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// Leere und gelöschte Slots sind genau die mit gesetztem Vorzeichenbit
+static inline uint32_t swiss_match_free(const int8_t* group) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+        if (group[i] < 0) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline void swiss_set_ctrl(swiss_array* t, size_t index, int8_t value) {
+    t->ctrl[index] = value;
+    if (index < SWISS_GROUP_WIDTH) t->ctrl[t->capacity + index] = value;
+}
+
+static inline size_t ds_entry_expiry_size(const ds_entry* e) {
+    return e->flags & DS_ENTRY_EXPIRES ? sizeof(ds_expiry) : 0;
+}
+
+const uint8_t* ds_entry_key(const ds_entry* e) {
+    return e->key_length <= SWISS_INLINE_KEY_SIZE ? e->key : e->block + ds_entry_expiry_size(e);
+}
+
+uint8_t* ds_entry_value(const ds_entry* e) {
+    if (e->value_length == 0) return NULL;
+    size_t offset = ds_entry_expiry_size(e);
+    return e->key_length <= SWISS_INLINE_KEY_SIZE ? e->block + offset : e->block + offset + e->key_length;
+}
+
+// So viele Bytes braucht der Block von e, also eine Ablaufzeit, ein ausgelagerter Key und das Value bzw. sein Offset
+size_t ds_entry_block_size(const ds_entry* e) {
+    size_t value_size = e->flags & DS_ENTRY_SPILLED ? sizeof(uint64_t) : e->value_length;
+    return ds_entry_expiry_size(e) + (e->key_length > SWISS_INLINE_KEY_SIZE ? e->key_length : 0) + value_size;
+}
+
+// Offset vom ausgelagerten Value. Steht hinter einem langen Key an beliebiger Stelle, deswegen memcpy().
+uint64_t ds_entry_spilled_offset(const ds_entry* e) {
+    uint64_t offset;
+    memcpy(&offset, ds_entry_value(e), sizeof(offset));
+    return offset;
+}
+
+void ds_entry_set_spilled_offset(ds_entry* e, uint64_t offset) {
+    memcpy(ds_entry_value(e), &offset, sizeof(offset));
+}
+
+ds_expiry* ds_entry_expiry(const ds_entry* e) {
+    return e->flags & DS_ENTRY_EXPIRES ? (ds_expiry*)e->block : NULL;
+}
+
+static void swiss_allocate(swiss_array* t, size_t capacity) {
+    t->ctrl = malloc(capacity + SWISS_GROUP_WIDTH);
+    t->slots = malloc(capacity * sizeof(ds_entry));
+    if (t->ctrl == NULL || t->slots == NULL) {
+        panic("%s\n", strerror(errno));
+    }
+    memset(t->ctrl, SWISS_EMPTY, capacity + SWISS_GROUP_WIDTH);
+
+    t->capacity = capacity;
+    t->size = 0;
+    t->tombstones = 0;
+    t->growth_left = capacity - capacity / 8;  // höchstens 7/8 voll, sonst werden die Probe-Sequenzen zu lang
+}
+
+static void swiss_release(swiss_array* t) {
+    free(t->ctrl);
+    free(t->slots);
+    memset(t, 0, sizeof(swiss_array));
+}
+
+void swiss_initialize(swiss_table* t) {
+    memset(t, 0, sizeof(swiss_table));
+    swiss_allocate(&t->current, SWISS_MIN_CAPACITY);
+}
+
+// Erster freier Slot in der Probe-Sequenz von hash. Es gibt immer einen, weil das Array nie ganz voll wird.
+static size_t swiss_find_free(swiss_array* t, uint32_t hash) {
+    size_t mask = t->capacity - 1;
+    size_t position = swiss_h1(hash) & mask;
+    size_t step = 0;
+
+    while (1) {
+        uint32_t free_slots = swiss_match_free(t->ctrl + position);
+        if (free_slots != 0) return (position + __builtin_ctz(free_slots)) & mask;
+
+        step += SWISS_GROUP_WIDTH;
+        position = (position + step) & mask;
+    }
+}
+
+static ds_entry* swiss_array_find(swiss_array* t, const uint8_t* key, size_t length, uint32_t hash) {
+    if (t->capacity == 0) return NULL;
+
+    size_t mask = t->capacity - 1;
+    size_t position = swiss_h1(hash) & mask;
+    size_t step = 0;
+    int8_t h2 = swiss_h2(hash);
+
+    while (1) {
+        const int8_t* group = t->ctrl + position;
+        for (uint32_t candidates = swiss_match(group, h2); candidates != 0; candidates &= candidates - 1) {
+            ds_entry* e = &t->slots[(position + __builtin_ctz(candidates)) & mask];
+            if (e->hash == hash && e->key_length == length && memcmp(ds_entry_key(e), key, length) == 0) return e;
+        }
+        // Ein leerer Slot in der Gruppe heißt, dass beim Einfügen hier aufgehört worden wäre
+        if (swiss_match(group, SWISS_EMPTY) != 0) return NULL;
+
+        step += SWISS_GROUP_WIDTH;
+        position = (position + step) & mask;
+    }
+}
+
+// Wie swiss_array_find(), erkennt den Eintrag aber an seinem Block statt am Key
+static ds_entry* swiss_array_find_block(swiss_array* t, uint32_t hash, const uint8_t* block) {
+    if (t->capacity == 0) return NULL;
+
+    size_t mask = t->capacity - 1;
+    size_t position = swiss_h1(hash) & mask;
+    size_t step = 0;
+    int8_t h2 = swiss_h2(hash);
+
+    while (1) {
+        const int8_t* group = t->ctrl + position;
+        for (uint32_t candidates = swiss_match(group, h2); candidates != 0; candidates &= candidates - 1) {
+            ds_entry* e = &t->slots[(position + __builtin_ctz(candidates)) & mask];
+            if (e->block == block) return e;
+        }
+        if (swiss_match(group, SWISS_EMPTY) != 0) return NULL;
+
+        step += SWISS_GROUP_WIDTH;
+        position = (position + step) & mask;
+    }
+}
+
+// Zieht bis zu slots Slots von previous nach current um. Gibt 1 zurück, solange danach noch etwas umzuziehen ist.
+// Der Hash steht im Slot, deswegen wird dabei kein Key angefasst. Block und Value bleiben, wo sie sind.
+int swiss_rehash_step(swiss_table* t, size_t slots) {
+    swiss_array* old = &t->previous;
+    if (old->capacity == 0) return 0;
+
+    size_t stop = t->migrate_position + slots < old->capacity ? t->migrate_position + slots : old->capacity;
+    for (; t->migrate_position < stop; t->migrate_position++) {
+        size_t i = t->migrate_position;
+        if (old->ctrl[i] < 0) continue;
+
+        // Für die umziehenden Einträge wurde beim Anlegen von current schon Platz reserviert
+        size_t index = swiss_find_free(&t->current, old->slots[i].hash);
+        if (t->current.ctrl[index] == SWISS_DELETED) {
+            t->current.tombstones--;
+            t->current.growth_left++;
+        }
+        swiss_set_ctrl(&t->current, index, swiss_h2(old->slots[i].hash));
+        t->current.slots[index] = old->slots[i];
+        t->current.size++;
+
+        swiss_set_ctrl(old, i, SWISS_DELETED);
+        old->size--;
+    }
+
+    if (t->migrate_position < old->capacity) return 1;
+
+    debug("Finished rehashing into %zu slots.\n", t->current.capacity);
+    swiss_release(old);
+    t->migrate_position = 0;
+    return 0;
+}
+
+// Legt ein neues Array an und fängt an, dahin umzuziehen. Sind vor allem gelöschte Slots schuld, dass kein Platz mehr ist,
+// bleibt die Größe gleich und beim Umziehen verschwinden nur die Tombstones.
+// Läuft noch ein Umzug, wird der vorher fertig gemacht. Das passiert nur, wenn zwischendurch sehr viel gelöscht wurde.
+static void swiss_start_rehash(swiss_table* t) {
+    if (t->previous.capacity != 0) swiss_rehash_step(t, t->previous.capacity);
+
+    size_t capacity = t->current.size + 1 > t->current.capacity * 7 / 16 ? t->current.capacity * 2 : t->current.capacity;
+    t->previous = t->current;
+    t->migrate_position = 0;
+    t->previous_hand = 0;
+    swiss_allocate(&t->current, capacity);
+    t->current.growth_left -= t->previous.size;
+    debug("Rehashing %zu entries from %zu into %zu slots.\n", t->previous.size, t->previous.capacity, capacity);
+}
+
+ds_entry* swiss_find(swiss_table* t, const uint8_t* key, size_t length, uint32_t hash) {
+    ds_entry* e = swiss_array_find(&t->current, key, length, hash);
+    if (e == NULL) e = swiss_array_find(&t->previous, key, length, hash);
+    return e;
+}
+
+// Sucht den Eintrag, dem block gehört, ohne den Key zu kennen. Blöcke gehören immer genau einem Eintrag,
+// der Hash führt dabei nur zur richtigen Stelle im Array.
+ds_entry* swiss_find_block(swiss_table* t, uint32_t hash, const uint8_t* block) {
+    ds_entry* e = swiss_array_find_block(&t->current, hash, block);
+    if (e == NULL) e = swiss_array_find_block(&t->previous, hash, block);
+    return e;
+}
+
+// Gibt den Slot für key zurück und legt ihn an, wenn es ihn noch nicht gibt (*inserted = 1).
+// Ein kurzer Key wird dabei in den Slot kopiert. Den Block mit langem Key und Value muss der Aufrufer
+// direkt danach selbst eintragen, vorher darf die Tabelle nicht weiter benutzt werden.
+// Pointer auf Slots sind nur bis zum nächsten swiss_insert(), swiss_erase() oder swiss_rehash_step() gültig,
+// weil Einträge dabei umziehen können.
+ds_entry* swiss_insert(swiss_table* t, const uint8_t* key, size_t length, uint32_t hash, int* inserted) {
+    swiss_rehash_step(t, SWISS_MIGRATE_PER_OPERATION);
+
+    ds_entry* existing = swiss_find(t, key, length, hash);
+    if (existing != NULL) {
+        *inserted = 0;
+        return existing;
+    }
+
+    swiss_array* a = &t->current;
+    size_t index = swiss_find_free(a, hash);
+    if (a->growth_left == 0 && a->ctrl[index] == SWISS_EMPTY) {
+        swiss_start_rehash(t);
+        index = swiss_find_free(a, hash);
+    }
+
+    if (a->ctrl[index] == SWISS_DELETED) {
+        a->tombstones--;
+    } else {
+        a->growth_left--;
+    }
+    swiss_set_ctrl(a, index, swiss_h2(hash));
+    a->size++;
+    t->size++;
+
+    ds_entry* e = &a->slots[index];
+    e->hash = hash;
+    e->key_length = length;
+    e->block = NULL;
+    e->value_length = 0;
+    e->flags = 0;
+    if (length <= SWISS_INLINE_KEY_SIZE) memcpy(e->key, key, length);
+
+    *inserted = 1;
+    return e;
+}
+
+// Entfernt e aus der Tabelle. Den Block muss der Aufrufer vorher freigeben.
+// Der Slot wird nur als gelöscht markiert, damit Probe-Sequenzen, die über ihn hinweg gehen, nicht abbrechen.
+void swiss_erase(swiss_table* t, ds_entry* e) {
+    swiss_array* a = e >= t->current.slots && e < t->current.slots + t->current.capacity ? &t->current : &t->previous;
+    swiss_set_ctrl(a, e - a->slots, SWISS_DELETED);
+    a->size--;
+    a->tombstones++;
+    t->size--;
+    // Für den Eintrag war in current noch Platz zum Umziehen reserviert, den braucht er jetzt nicht mehr
+    if (a == &t->previous) t->current.growth_left++;
+
+    swiss_rehash_step(t, SWISS_MIGRATE_PER_OPERATION);
+}
+
+// Sucht mit dem CLOCK-Verfahren einen Eintrag, der verdrängt werden kann. Der Zeiger läuft einfach über die Slots:
+// Wurde ein Eintrag seit dem letzten Mal benutzt, wird nur das Bit gelöscht und er bekommt eine zweite Chance,
+// sonst ist er der nächste Kandidat. Das kommt LRU nahe, ohne bei jedem Zugriff eine Liste umzuhängen.
+// Während eines Umzugs kommen zuerst die Einträge dran, die noch in previous stehen.
+// Nach spätestens zwei Runden ist jedes Bit gelöscht, deswegen gibt es nur bei einer leeren Tabelle NULL.
+ds_entry* swiss_clock_victim(swiss_table* t) {
+    if (t->size == 0) return NULL;
+
+    for (int round = 0; round < 2; round++) {
+        swiss_array* old = &t->previous;
+        if (t->previous_hand < t->migrate_position) t->previous_hand = t->migrate_position;
+        for (; t->previous_hand < old->capacity; t->previous_hand++) {
+            size_t i = t->previous_hand;
+            if (old->ctrl[i] < 0) continue;
+            if (!(old->slots[i].flags & DS_ENTRY_REFERENCED)) return &old->slots[i];
+            old->slots[i].flags &= ~DS_ENTRY_REFERENCED;
+        }
+        t->previous_hand = t->migrate_position;  // nächste Runde fängt in previous wieder vorne an
+
+        swiss_array* a = &t->current;
+        for (size_t n = 0; n < a->capacity; n++) {
+            size_t i = t->clock_hand & (a->capacity - 1);
+            t->clock_hand = i + 1;
+            if (a->ctrl[i] < 0) continue;
+            if (!(a->slots[i].flags & DS_ENTRY_REFERENCED)) return &a->slots[i];
+            a->slots[i].flags &= ~DS_ENTRY_REFERENCED;
+        }
+    }
+
+    return NULL;
+}
+
+// Bytes, die Slots und Kontrollbytes gerade belegen, während eines Umzugs also von beiden Arrays zusammen
+size_t swiss_memory_usage(swiss_table* t) {
+    size_t usage = 0;
+    swiss_array* arrays[2] = {&t->current, &t->previous};
+    for (int i = 0; i < 2; i++) {
+        if (arrays[i]->capacity > 0) usage += arrays[i]->capacity * (sizeof(ds_entry) + 1) + SWISS_GROUP_WIDTH;
+    }
+    return usage;
+}
+
+// Ruft visit(e, context) für jeden Eintrag auf. visit darf die Tabelle dabei nicht verändern.
+void swiss_foreach(swiss_table* t, void (*visit)(ds_entry* e, void* context), void* context) {
+    swiss_array* arrays[2] = {&t->current, &t->previous};
+    for (int a = 0; a < 2; a++) {
+        for (size_t i = 0; i < arrays[a]->capacity; i++) {
+            if (arrays[a]->ctrl[i] >= 0) visit(&arrays[a]->slots[i], context);
+        }
+    }
+}
+
+// Zieht alles auf einmal ins neue Array um, damit es danach nur noch current gibt
+void swiss_finish_rehash(swiss_table* t) {
+    if (t->previous.capacity != 0) swiss_rehash_step(t, t->previous.capacity);
+}
+
+// Ersetzt den Inhalt von t durch eine Kopie von ctrl und slots, so wie sie vorher in current standen (siehe snapshot.c).
+// Die Slots werden nicht neu einsortiert, die Hashes darin müssen also mit swiss_hash() berechnet worden sein.
+void swiss_restore(swiss_table* t, const int8_t* ctrl, const ds_entry* slots, size_t capacity, size_t size, size_t tombstones) {
+    swiss_release(&t->current);
+    swiss_release(&t->previous);
+    swiss_allocate(&t->current, capacity);
+
+    memcpy(t->current.ctrl, ctrl, capacity + SWISS_GROUP_WIDTH);
+    memcpy(t->current.slots, slots, capacity * sizeof(ds_entry));
+    t->current.size = size;
+    t->current.tombstones = tombstones;
+    t->current.growth_left -= size + tombstones;
+    t->size = size;
+    t->migrate_position = 0;
+    t->clock_hand = 0;
+    t->previous_hand = 0;
+}
+
+void swiss_destruct(swiss_table* t, void (*release)(ds_entry* e)) {
+    swiss_array* arrays[2] = {&t->current, &t->previous};
+    for (int a = 0; a < 2; a++) {
+        for (size_t i = 0; i < arrays[a]->capacity; i++) {
+            if (arrays[a]->ctrl[i] < 0) continue;
+            if (release != NULL) release(&arrays[a]->slots[i]);
+        }
+        swiss_release(arrays[a]);
+    }
+    t->size = 0;
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef SWISSTABLE_H
+#define SWISSTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "timerwheel.h"
+
+// So viele Kontrollbytes werden auf einmal verglichen, das ist genau ein SSE2 Register
+#define SWISS_GROUP_WIDTH 16
+#define SWISS_MIN_CAPACITY 16
+// So viele Slots zieht jedes Einfügen und Löschen während einer Vergrößerung um. Das neue Array ist doppelt so groß,
+// mit mehr als 2 pro Einfügen ist das alte also sicher leer, bevor das neue wieder voll ist.
+#define SWISS_MIGRATE_PER_OPERATION 16
+// Keys bis zu dieser Länge stehen direkt im Slot, längere stehen am Anfang vom Block vor dem Value
+#define SWISS_INLINE_KEY_SIZE 13
+
+// Kontrollbytes: ein voller Slot speichert die unteren 7 Bit vom Hash (0..127), leere und gelöschte sind negativ
+#define SWISS_EMPTY ((int8_t)-128)
+#define SWISS_DELETED ((int8_t)-2)
+
+// Bits in ds_entry.flags
+#define DS_ENTRY_REFERENCED 0x1  // seit dem letzten Vorbeikommen vom CLOCK-Zeiger benutzt
+#define DS_ENTRY_EXPIRES 0x2     // der Block fängt mit einem ds_expiry an
+#define DS_ENTRY_MAPPED 0x4      // der Block liegt im Snapshot und gehört keinem Slab
+#define DS_ENTRY_SPILLED 0x8     // statt dem Value steht im Block sein Offset in der Value-Datei
+#define DS_ENTRY_SHARED 0x10     // für den Block (ausgelagert: für das Value) gab es mal einen Pin, der vielleicht noch lebt
+
+// Ein Eintrag im Datastore. Mit 32 Bytes passen zwei davon in eine Cache Line, und bei kurzen Keys
+// reicht der Slot selbst, um den Key zu vergleichen, ohne irgendeinem Pointer zu folgen.
+// Alles, was nicht in den Slot passt, liegt zusammen in einem Block: erst ein ds_expiry, falls der Key abläuft,
+// dann ein langer Key, dann das Value. Bei ausgelagerten Values steht dort nur ein uint64_t Offset, value_length
+// bleibt aber die Länge vom Value.
+typedef struct {
+    uint32_t hash;  // ganzer Hash, damit beim Vergrößern kein Key neu gehasht werden muss
+    uint32_t value_length;
+    uint8_t* block;  // NULL bei kurzem Key und leerem Value
+    uint16_t key_length;
+    uint8_t flags;
+    uint8_t key[SWISS_INLINE_KEY_SIZE];
+} ds_entry;
+
+// Ablaufzeit von einem Eintrag mit TTL. Liegt im Block statt im Slot, damit Einträge ohne TTL nichts dafür bezahlen.
+typedef struct {
+    wheel_timer timer;  // muss vorne stehen, das Timer-Rad liefert beim Ablaufen nur den Pointer darauf
+    uint32_t hash;  // damit der abgelaufene Timer seinen Slot über swiss_find_block() wiederfindet
+} ds_expiry;
+
+// Ein Array von Slots mit den zugehörigen Kontrollbytes
+typedef struct {
+    int8_t* ctrl;  // capacity + SWISS_GROUP_WIDTH Bytes, die letzten sind eine Kopie der ersten, damit Gruppen am Ende nicht umbrechen
+    ds_entry* slots;
+    size_t capacity;  // immer eine Zweierpotenz, 0 wenn das Array nicht benutzt wird
+    size_t size;
+    size_t tombstones;
+    size_t growth_left;  // so viele leere Slots dürfen noch belegt werden, bevor das Array wachsen muss
+} swiss_array;
+
+// Hash Table mit offener Adressierung nach dem Vorbild von Abseils Swiss Table. Zu jedem Slot gibt es ein Kontrollbyte,
+// und beim Suchen werden immer SWISS_GROUP_WIDTH davon gleichzeitig mit den 7 Bit vom gesuchten Hash verglichen.
+// Nur bei Treffern wird der Slot selbst angeschaut, dadurch bleibt eine Suche meistens in ein bis zwei Cache Lines.
+//
+// Beim Vergrößern wird nicht alles auf einmal umkopiert, das würde bei vielen Millionen Keys den ganzen Peer anhalten.
+// Stattdessen bleibt das alte Array als previous erhalten, und jede Änderung sowie swiss_rehash_step() aus der
+// Event Loop zieht ein paar Slots ins neue Array um. Jeder Eintrag steht dabei immer in genau einem der beiden Arrays.
+typedef struct {
+    swiss_array current;
+    swiss_array previous;
+    size_t migrate_position;  // bis hierhin ist previous schon leer geräumt
+    size_t size;
+    size_t clock_hand;     // Position vom CLOCK-Zeiger in current
+    size_t previous_hand;  // und in previous, solange ein Umzug läuft
+} swiss_table;
+
+void swiss_initialize(swiss_table* t);
+uint32_t swiss_hash(const uint8_t* key, size_t length);
+const uint8_t* ds_entry_key(const ds_entry* e);
+uint8_t* ds_entry_value(const ds_entry* e);
+size_t ds_entry_block_size(const ds_entry* e);
+uint64_t ds_entry_spilled_offset(const ds_entry* e);
+void ds_entry_set_spilled_offset(ds_entry* e, uint64_t offset);
+ds_expiry* ds_entry_expiry(const ds_entry* e);
+ds_entry* swiss_find(swiss_table* t, const uint8_t* key, size_t length, uint32_t hash);
+ds_entry* swiss_find_block(swiss_table* t, uint32_t hash, const uint8_t* block);
+ds_entry* swiss_insert(swiss_table* t, const uint8_t* key, size_t length, uint32_t hash, int* inserted);
+void swiss_erase(swiss_table* t, ds_entry* e);
+int swiss_rehash_step(swiss_table* t, size_t slots);
+size_t swiss_memory_usage(swiss_table* t);
+ds_entry* swiss_clock_victim(swiss_table* t);
+void swiss_foreach(swiss_table* t, void (*visit)(ds_entry* e, void* context), void* context);
+void swiss_finish_rehash(swiss_table* t);
+void swiss_restore(swiss_table* t, const int8_t* ctrl, const ds_entry* slots, size_t capacity, size_t size, size_t tombstones);
+void swiss_destruct(swiss_table* t, void (*release)(ds_entry* e));
+
+#endif
\ No newline at end of file
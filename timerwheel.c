@@ -0,0 +1,87 @@
+#include <string.h>
+#include "timerwheel.h"
+
+void timer_wheel_initialize(timer_wheel* w, uint32_t now) {
+    memset(w, 0, sizeof(timer_wheel));
+    w->now = now;
+}
+
+static void timer_wheel_link(wheel_timer** slot, wheel_timer* t) {
+    t->next = *slot;
+    if (t->next != NULL) t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
+
+// Hängt t in den Slot, der bei t->deadline an der Reihe ist. Die Ebene ist die niedrigste, deren ganzer Umlauf
+// noch bis zur Deadline reicht. Deadline == now landet im aktuellen Slot von Ebene 0, das darf nur beim Kaskadieren
+// passieren, weil timer_wheel_advance() diesen Slot direkt danach abarbeitet.
+static void timer_wheel_place(timer_wheel* w, wheel_timer* t) {
+    uint32_t delta = t->deadline - w->now;
+    uint32_t slot_time = t->deadline;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1u << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    // Zu weit in der Zukunft: erstmal in den letzten Slot der obersten Ebene, von da wird später neu einsortiert
+    if (level == TIMER_WHEEL_LEVELS - 1 && delta >= (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))) {
+        slot_time = w->now + (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+
+    size_t index = (slot_time >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    timer_wheel_link(&w->slots[level][index], t);
+}
+
+// Deadlines, die schon erreicht sind, laufen beim nächsten Tick ab
+void timer_wheel_add(timer_wheel* w, wheel_timer* t, uint32_t deadline) {
+    if ((int32_t)(deadline - w->now) <= 0) deadline = w->now + 1;
+    t->deadline = deadline;
+    timer_wheel_place(w, t);
+    w->count++;
+}
+
+// Darf auch mit einem Timer aufgerufen werden, der gerade nicht eingehängt ist
+void timer_wheel_remove(timer_wheel* w, wheel_timer* t) {
+    if (t->pprev == NULL) return;
+
+    *t->pprev = t->next;
+    if (t->next != NULL) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    w->count--;
+}
+
+// Dreht das Rad Tick für Tick bis now weiter und ruft für jeden abgelaufenen Timer expire(t, context) auf.
+// Der Timer ist dann schon ausgehängt, expire darf ihn also freigeben oder neu einhängen.
+// Gibt die Anzahl der abgelaufenen Timer zurück.
+size_t timer_wheel_advance(timer_wheel* w, uint32_t now, void (*expire)(wheel_timer* t, void* context), void* context) {
+    size_t expired = 0;
+
+    while ((int32_t)(now - w->now) > 0) {
+        w->now++;
+
+        // Fängt auf einer Ebene ein neuer Umlauf an, wird der passende Slot der Ebene darüber auf die tieferen verteilt
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((w->now & ((1u << (TIMER_WHEEL_BITS * level)) - 1)) != 0) break;
+
+            size_t index = (w->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+            wheel_timer* t = w->slots[level][index];
+            w->slots[level][index] = NULL;
+            while (t != NULL) {
+                wheel_timer* next = t->next;
+                timer_wheel_place(w, t);
+                t = next;
+            }
+        }
+
+        wheel_timer** slot = &w->slots[0][w->now & (TIMER_WHEEL_SLOTS - 1)];
+        while (*slot != NULL) {
+            wheel_timer* t = *slot;
+            timer_wheel_remove(w, t);
+            expire(t, context);
+            expired++;
+        }
+    }
+
+    return expired;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Jede Ebene hat 64 Slots, eine Ebene höher ist ein Slot also 64 mal so lang wie ein ganzer Umlauf der Ebene darunter.
+// Mit 5 Ebenen reicht das Rad 2^30 Ticks in die Zukunft, spätere Timer werden beim Kaskadieren einfach neu einsortiert.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 5
+
+// Zum Einbetten in das struct, das ablaufen soll. Das Rad allokiert selbst nichts.
+typedef struct wheel_timer {
+    struct wheel_timer* next;
+    struct wheel_timer** pprev;  // zeigt auf den Pointer, der auf diesen Timer zeigt, NULL wenn er in keinem Slot hängt
+    uint32_t deadline;  // in Ticks, läuft ab, sobald das Rad diesen Tick erreicht
+} wheel_timer;
+
+// Hierarchisches Timer-Rad wie im Linux Kernel. Einhängen und Aushängen kosten O(1), und beim Weiterdrehen wird jeder
+// Timer höchstens einmal pro Ebene in eine tiefere umgehängt. Pro Timer ist das also konstanter Aufwand, egal wie viele
+// Millionen gleichzeitig im Rad hängen, und leere Ticks kosten nur einen Blick in einen leeren Slot.
+typedef struct {
+    uint32_t now;
+    size_t count;
+    wheel_timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel;
+
+void timer_wheel_initialize(timer_wheel* w, uint32_t now);
+void timer_wheel_add(timer_wheel* w, wheel_timer* t, uint32_t deadline);
+void timer_wheel_remove(timer_wheel* w, wheel_timer* t);
+size_t timer_wheel_advance(timer_wheel* w, uint32_t now, void (*expire)(wheel_timer* t, void* context), void* context);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "valuefile.h"
+#include "debug.h"
+
+// Öffnet die Datei unter path und leert sie. Gibt -1 zurück, wenn das nicht geht.
+int value_file_open(value_file* f, const char* path) {
+    memset(f, 0, sizeof(value_file));
+    f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (f->fd == -1) {
+        warn("Couldn't open value file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Hängt value an und gibt seinen Offset in der Datei zurück, oder -1, wenn es nicht geschrieben werden konnte.
+// Ohne fsync, nach einem Absturz wird die Datei sowieso nicht mehr gebraucht.
+int64_t value_file_append(value_file* f, const uint8_t* value, size_t length) {
+    uint64_t offset = f->end;
+    size_t written = 0;
+    while (written < length) {
+        ssize_t result = pwrite(f->fd, value + written, length - written, offset + written);
+        if (result == -1) {
+            if (errno == EINTR) continue;
+            warn("Couldn't write to value file: %s\n", strerror(errno));
+            // Was schon geschrieben wurde, gehört niemandem, der Bereich wird also gleich wieder freigegeben
+            f->end += written;
+            f->live_bytes += written;
+            value_file_release(f, offset, written);
+            return -1;
+        }
+        written += result;
+    }
+
+    f->end += length;
+    f->live_bytes += length;
+    return offset;
+}
+
+// Liest length Bytes ab offset nach buffer. Kommt auch im Kindprozess nach fork() ohne stdio aus, solange alles klappt.
+int value_file_read(value_file* f, uint64_t offset, uint8_t* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t result = pread(f->fd, buffer + done, length - done, offset + done);
+        if (result == -1 && errno == EINTR) continue;
+        if (result == 0) errno = EIO;
+        if (result <= 0) return -1;
+        done += result;
+    }
+    return 0;
+}
+
+static void value_file_punch(value_file* f, uint64_t offset, uint64_t length) {
+    if (length == 0) return;
+    if (fallocate(f->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == -1) {
+        debug("Couldn't punch hole into value file: %s\n", strerror(errno));
+    }
+}
+
+// Das Value ab offset wird nicht mehr gebraucht
+void value_file_release(value_file* f, uint64_t offset, size_t length) {
+    f->live_bytes -= length;
+    f->released_bytes += length;
+    if (f->holds == 0) {
+        value_file_punch(f, offset, length);
+        return;
+    }
+
+    if (f->deferred_count == f->deferred_capacity) {
+        f->deferred_capacity = f->deferred_capacity == 0 ? 64 : f->deferred_capacity * 2;
+        f->deferred = realloc(f->deferred, f->deferred_capacity * sizeof(value_range));
+        if (f->deferred == NULL) {
+            panic("%s\n", strerror(errno));
+        }
+    }
+    f->deferred[f->deferred_count++] = (value_range){.offset = offset, .length = length};
+}
+
+// Vor dem fork() von einem Kindprozess, der Values liest
+void value_file_hold(value_file* f) {
+    f->holds++;
+}
+
+// Der Kindprozess ist fertig. War es der letzte, werden alle gesammelten Bereiche gelocht.
+void value_file_unhold(value_file* f) {
+    if (--f->holds > 0) return;
+    for (size_t i = 0; i < f->deferred_count; i++) value_file_punch(f, f->deferred[i].offset, f->deferred[i].length);
+    f->deferred_count = 0;
+}
+
+void value_file_close(value_file* f) {
+    close(f->fd);
+    free(f->deferred);
+    f->deferred = NULL;
+    f->fd = -1;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef VALUEFILE_H
+#define VALUEFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ein freigegebener Bereich, der erst gelocht wird, wenn niemand mehr die Datei vom Zeitpunkt vom fork() braucht
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} value_range;
+
+// Datei für Values, die nicht im Speicher bleiben sollen. Values werden nur hinten angehängt und nie überschrieben.
+// Wird eins gelöscht oder ersetzt, wird sein Bereich mit FALLOC_FL_PUNCH_HOLE gelocht, das Dateisystem gibt den
+// Platz dann frei, ohne dass irgendetwas umkopiert werden muss. Die Datei ist ein Cache für den Speicher und
+// wird bei jedem Start geleert, Snapshot und Log enthalten die Values selbst.
+//
+// Solange ein Kindprozess (Snapshot oder Umschreiben vom Log) noch Values aus der Datei liest, wird nichts gelocht,
+// sonst fände er statt dem Value vom Zeitpunkt vom fork() nur Nullen. Die Bereiche werden in deferred gesammelt.
+typedef struct {
+    int fd;
+    uint64_t end;  // hier wird das nächste Value angehängt
+    uint64_t live_bytes;
+    uint64_t released_bytes;
+    int holds;  // Anzahl der Kindprozesse, die noch lesen
+    value_range* deferred;
+    size_t deferred_count;
+    size_t deferred_capacity;
+} value_file;
+
+int value_file_open(value_file* f, const char* path);
+int64_t value_file_append(value_file* f, const uint8_t* value, size_t length);
+int value_file_read(value_file* f, uint64_t offset, uint8_t* buffer, size_t length);
+void value_file_release(value_file* f, uint64_t offset, size_t length);
+void value_file_hold(value_file* f);
+void value_file_unhold(value_file* f);
+void value_file_close(value_file* f);
+
+#endif
\ No newline at end of file